@@ -1,4 +1,11 @@
 $VULKAN_SDK/bin/glslc ../resources/shaders/source/post-process-shader.vert -o ../resources/shaders/generated/post-process-vert.spv
 $VULKAN_SDK/bin/glslc ../resources/shaders/source/post-process-shader.frag -o ../resources/shaders/generated/post-process-frag.spv
 $VULKAN_SDK/bin/glslc ../resources/shaders/source/ray-trace-compute.comp -o ../resources/shaders/generated/ray-trace-compute.spv
+$VULKAN_SDK/bin/glslc -DQUANTIZED_BVH ../resources/shaders/source/ray-trace-compute.comp -o ../resources/shaders/generated/ray-trace-compute-quantized.spv
+$VULKAN_SDK/bin/glslc -DWIDE_BVH ../resources/shaders/source/ray-trace-compute.comp -o ../resources/shaders/generated/ray-trace-compute-wide.spv
 $VULKAN_SDK/bin/glslc ../resources/shaders/source/ray-trace-compute-simple.comp -o ../resources/shaders/generated/ray-trace-compute-simple.spv
+$VULKAN_SDK/bin/glslc ../resources/shaders/source/bvh-refit.comp -o ../resources/shaders/generated/bvh-refit.spv
+# Shader counters builds, see SHADER_COUNTERS in main.cpp. Subgroup operations need Vulkan 1.1.
+$VULKAN_SDK/bin/glslc --target-env=vulkan1.1 -DSHADER_COUNTERS ../resources/shaders/source/ray-trace-compute.comp -o ../resources/shaders/generated/ray-trace-compute-counters.spv
+$VULKAN_SDK/bin/glslc --target-env=vulkan1.1 -DSHADER_COUNTERS -DQUANTIZED_BVH ../resources/shaders/source/ray-trace-compute.comp -o ../resources/shaders/generated/ray-trace-compute-quantized-counters.spv
+$VULKAN_SDK/bin/glslc --target-env=vulkan1.1 -DSHADER_COUNTERS -DWIDE_BVH ../resources/shaders/source/ray-trace-compute.comp -o ../resources/shaders/generated/ray-trace-compute-wide-counters.spv
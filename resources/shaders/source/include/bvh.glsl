@@ -0,0 +1,392 @@
+// Bvh traversal, shared by the ray tracing shaders.
+// Expects ray, hit_record, hit_triangle, hit_sphere, the bvh buffer and the instances buffer to be defined before the include.
+
+// Traverse near children first and skip nodes behind the closest hit found so far.
+// Set to false to get the plain depth-first traversal, e.g. to compare them in the bvh benchmark.
+layout(constant_id = 0) const bool orderedTraversal = true;
+// Count traversal statistics in bvhNodesVisited, bvhTrianglesTested and bvhRaysTraced.
+#ifdef SHADER_COUNTERS
+// The shader counters build always counts.
+const bool countBvhStats = true;
+#else
+layout(constant_id = 1) const bool countBvhStats = false;
+#endif
+// Stackless traversal of compact nodes with miss links, has to match BvhLayout::Roped.
+layout(constant_id = 2) const bool ropedTraversal = false;
+
+// Statistics of the current invocation, only counted with countBvhStats.
+uint bvhNodesVisited = 0u;
+uint bvhTrianglesTested = 0u;
+uint bvhRaysTraced = 0u;
+
+// no intersection means vec.x > vec.y (really tNear > tFar)
+vec2 intersectAABB(ray r, vec3 boxMin, vec3 boxMax) {
+    vec3 tMin = (boxMin - r.origin) / r.dir;
+    vec3 tMax = (boxMax - r.origin) / r.dir;
+    vec3 t1 = min(tMin, tMax);
+    vec3 t2 = max(tMin, tMax);
+    float tNear = max(max(t1.x, t1.y), t1.z);
+    float tFar = min(min(t2.x, t2.y), t2.z);
+    return vec2(tNear, tFar);
+}
+
+// Tells if a box with entry and exit distances tBox has to be traversed.
+// Ordered traversal also skips boxes behind the ray and boxes entered after the closest hit.
+bool traverseBox(vec2 tBox, float t_min, float closest_so_far) {
+    if (orderedTraversal) {
+        return tBox.x <= tBox.y && tBox.y >= t_min && tBox.x <= closest_so_far;
+    }
+    return tBox.x <= tBox.y;
+}
+
+// Intersects the primitives of a leaf, packedCount holds their number and type.
+bool hit_leaf(int offset, int packedCount, ray r, float t_min, inout float closest_so_far, inout hit_record rec) {
+    int count = packedCount & PRIMITIVE_COUNT_MASK;
+    bool spheres = (packedCount >> PRIMITIVE_TYPE_SHIFT) == SPHERE_PRIMITIVE;
+    if (countBvhStats && !spheres) bvhTrianglesTested += uint(count);
+
+    bool hit_anything = false;
+    for (int i = offset; i < offset + count; i++) {
+        hit_record temp_rec;
+        bool hit = spheres ? hit_sphere(i, r, t_min, closest_so_far, temp_rec)
+                           : hit_triangle(i, r, t_min, closest_so_far, temp_rec);
+        if (hit) {
+            hit_anything = true;
+            closest_so_far = temp_rec.t;
+            rec = temp_rec;
+        }
+    }
+    return hit_anything;
+}
+
+// Size of the traversal stack, Scene::bvhStackSize. The host computes the worst case of the bvh,
+// so the checks against it below never drop a node.
+layout(constant_id = 5) const int MAX_STACK_DEPTH = 16;
+
+#if defined(WIDE_BVH)
+// Traversal of a 4-wide bvh. Every node fetch tests the boxes of all 4 children at once,
+// leaf children are intersected right away and inner children are pushed to the stack.
+bool hit_bvh(ray r, inout hit_record rec) {
+    float t_min = 0.001;
+    float t_max = 10000;
+
+    bool hit_anything = false;
+    float closest_so_far = t_max;
+
+    int nodeStack[MAX_STACK_DEPTH];
+    // Entry distance of the nodes on the stack.
+    float tStack[MAX_STACK_DEPTH];
+    int stackIndex = 0;
+
+    nodeStack[stackIndex] = 0;
+    tStack[stackIndex] = 0.0;
+    stackIndex++;
+
+    if (countBvhStats) bvhRaysTraced++;
+
+    while (stackIndex > 0) {
+        stackIndex--;
+        // A hit closer than the node may have been found after it was pushed.
+        if (orderedTraversal && tStack[stackIndex] > closest_so_far) continue;
+        wideBvhNode node = bvh[nodeStack[stackIndex]];
+        if (countBvhStats) bvhNodesVisited++;
+
+        // Slab test of the 4 child boxes, one lane per child.
+        vec4 tx0 = (node.minX - r.origin.x) / r.dir.x;
+        vec4 tx1 = (node.maxX - r.origin.x) / r.dir.x;
+        vec4 ty0 = (node.minY - r.origin.y) / r.dir.y;
+        vec4 ty1 = (node.maxY - r.origin.y) / r.dir.y;
+        vec4 tz0 = (node.minZ - r.origin.z) / r.dir.z;
+        vec4 tz1 = (node.maxZ - r.origin.z) / r.dir.z;
+        vec4 tNear = max(max(min(tx0, tx1), min(ty0, ty1)), min(tz0, tz1));
+        vec4 tFar = min(min(max(tx0, tx1), max(ty0, ty1)), max(tz0, tz1));
+
+        bool hitChild[4];
+        int order[4];
+        for (int c = 0; c < 4; c++) {
+            hitChild[c] = node.count[c] >= 0 && traverseBox(vec2(tNear[c], tFar[c]), t_min, closest_so_far);
+            order[c] = c;
+        }
+
+        // Sort the children by entry distance.
+        if (orderedTraversal) {
+            for (int i = 1; i < 4; i++) {
+                int c = order[i];
+                int j = i;
+                for (; j > 0 && tNear[order[j - 1]] > tNear[c]; j--) {
+                    order[j] = order[j - 1];
+                }
+                order[j] = c;
+            }
+        }
+
+        // Leaf children from near to far, so the near hits cull the far leaves.
+        for (int i = 0; i < 4; i++) {
+            int c = order[i];
+            int count = node.count[c];
+            if (count <= 0 || !hitChild[c]) continue;
+            if (orderedTraversal && tNear[c] > closest_so_far) continue;
+
+            // Leaf child references a range of primitives starting at child.
+            if (hit_leaf(node.child[c], count, r, t_min, closest_so_far, rec)) {
+                hit_anything = true;
+            }
+        }
+
+        // Inner children from far to near, so the nearest one is popped first.
+        for (int i = 3; i >= 0; i--) {
+            int c = order[i];
+            if (node.count[c] != 0 || !hitChild[c] || stackIndex == MAX_STACK_DEPTH) continue;
+            nodeStack[stackIndex] = node.child[c];
+            tStack[stackIndex] = tNear[c];
+            stackIndex++;
+        }
+    }
+
+    return hit_anything;
+}
+#elif defined(QUANTIZED_BVH)
+vec4 unpackBytes(uint v) {
+    return vec4(v & 0xFFu, (v >> 8) & 0xFFu, (v >> 16) & 0xFFu, v >> 24);
+}
+
+// Traversal of quantized nodes, which store the boxes of their children relative to their own box.
+// The box of a node is decoded from its parent and kept on the stack together with the node index.
+bool hit_bvh(ray r, inout hit_record rec) {
+    float t_min = 0.001;
+    float t_max = 10000;
+
+    bool hit_anything = false;
+    float closest_so_far = t_max;
+
+    int nodeStack[MAX_STACK_DEPTH];
+    vec3 minStack[MAX_STACK_DEPTH];
+    vec3 maxStack[MAX_STACK_DEPTH];
+    // Entry distance of the nodes on the stack.
+    float tStack[MAX_STACK_DEPTH];
+    int stackIndex = 0;
+
+    if (countBvhStats) bvhRaysTraced++;
+
+    vec2 tRoot = intersectAABB(r, ubo.bvhMin, ubo.bvhMax);
+    if (!traverseBox(tRoot, t_min, closest_so_far)) return false;
+
+    nodeStack[stackIndex] = 0;
+    minStack[stackIndex] = ubo.bvhMin;
+    maxStack[stackIndex] = ubo.bvhMax;
+    tStack[stackIndex] = tRoot.x;
+    stackIndex++;
+
+    while (stackIndex > 0) {
+        stackIndex--;
+        // A hit closer than the node may have been found after it was pushed.
+        if (orderedTraversal && tStack[stackIndex] > closest_so_far) continue;
+        int currentNode = nodeStack[stackIndex];
+        vec3 frameMin = minStack[stackIndex];
+        vec3 frameMax = maxStack[stackIndex];
+        if (countBvhStats) bvhNodesVisited++;
+
+        uvec4 node = bvh[currentNode];
+        if (node.w == QUANTIZED_LEAF) {
+            // Leaf node references a range of primitives starting at node.x, node.y is the packed count.
+            if (hit_leaf(int(node.x), int(node.y), r, t_min, closest_so_far, rec)) {
+                hit_anything = true;
+            }
+            continue;
+        }
+
+        // Bytes are left min xyz, left max xyz, right min xyz, right max xyz, in steps of 1/255 of the node box.
+        // Must be decoded exactly like Bvh::quantizeBox does.
+        vec4 b0 = unpackBytes(node.x);
+        vec4 b1 = unpackBytes(node.y);
+        vec4 b2 = unpackBytes(node.z);
+        vec3 step = (frameMax - frameMin) * (1.0 / 255.0);
+
+        vec3 childMin[2] = {frameMin + b0.xyz * step, frameMin + vec3(b1.zw, b2.x) * step};
+        vec3 childMax[2] = {frameMin + vec3(b0.w, b1.xy) * step, frameMin + b2.yzw * step};
+        int children[2] = {currentNode + 1, int(node.w)};
+        vec2 tChild[2] = {intersectAABB(r, childMin[0], childMax[0]), intersectAABB(r, childMin[1], childMax[1])};
+
+        // Push the far child first, so the near one is popped next.
+        int near = orderedTraversal && tChild[1].x < tChild[0].x ? 1 : 0;
+        for (int i = 0; i < 2; i++) {
+            int c = i == 0 ? 1 - near : near;
+            if (!traverseBox(tChild[c], t_min, closest_so_far) || stackIndex == MAX_STACK_DEPTH) continue;
+            nodeStack[stackIndex] = children[c];
+            minStack[stackIndex] = childMin[c];
+            maxStack[stackIndex] = childMax[c];
+            tStack[stackIndex] = tChild[c].x;
+            stackIndex++;
+        }
+    }
+
+    return hit_anything;
+}
+#else
+// Stackless traversal of a roped bvh, see Bvh::rope. Nodes are visited in depth-first order:
+// a hit box continues with the next node, a missed box skips its subtree by following the miss link.
+// Ordered traversal only culls boxes behind the closest hit, the order of the children is fixed.
+bool hit_bvh_roped(ray r, inout hit_record rec) {
+    float t_min = 0.001;
+    float t_max = 10000;
+
+    bool hit_anything = false;
+    float closest_so_far = t_max;
+
+    if (countBvhStats) bvhRaysTraced++;
+
+    int nodeCount = bvh.length();
+    int currentNode = 0;
+    while (currentNode < nodeCount) {
+        if (countBvhStats) bvhNodesVisited++;
+
+        vec2 tIntersect = intersectAABB(r, bvh[currentNode].min, bvh[currentNode].max);
+        int offset = bvh[currentNode].offset;
+        int count = bvh[currentNode].count;
+        if (!traverseBox(tIntersect, t_min, closest_so_far)) {
+            // Miss link, inner nodes store it in offset, for leaves it is the next node.
+            currentNode = count > 0 ? currentNode + 1 : offset;
+            continue;
+        }
+
+        // Leaf node references a range of primitives starting at offset.
+        if (count > 0 && hit_leaf(offset, count, r, t_min, closest_so_far, rec)) {
+            hit_anything = true;
+        }
+        // Hit link, always the next node.
+        currentNode++;
+    }
+
+    return hit_anything;
+}
+
+// Stack entries of the compact traversal below the node indices, for instances of meshes with their own bvh.
+// EXIT_INSTANCE restores the world space ray, ENTER_INSTANCE - i enters instance i.
+#define EXIT_INSTANCE -1
+#define ENTER_INSTANCE -2
+
+vec3 transformPoint(vec4 rows[3], vec3 p) {
+    return vec3(dot(rows[0], vec4(p, 1.0)), dot(rows[1], vec4(p, 1.0)), dot(rows[2], vec4(p, 1.0)));
+}
+
+vec3 transformVector(vec4 rows[3], vec3 v) {
+    return vec3(dot(rows[0].xyz, v), dot(rows[1].xyz, v), dot(rows[2].xyz, v));
+}
+
+// Moves a hit found in object space of an instance to world space.
+// The ray direction is not normalized in object space, so t is the same in both spaces.
+void instanceHitToWorld(int instanceIndex, inout hit_record rec) {
+    rec.p = transformPoint(instances[instanceIndex].objectToWorld, rec.p);
+    // Normals are transformed by the inverse transpose.
+    vec3 n = rec.normal;
+    rec.normal = normalize(n.x * instances[instanceIndex].worldToObject[0].xyz +
+                           n.y * instances[instanceIndex].worldToObject[1].xyz +
+                           n.z * instances[instanceIndex].worldToObject[2].xyz);
+}
+
+bool hit_bvh(ray r, inout hit_record rec) {
+    if (ropedTraversal) {
+        return hit_bvh_roped(r, rec);
+    }
+
+    float t_min = 0.001;
+    float t_max = 10000;
+
+    bool hit_anything = false;
+    float closest_so_far = t_max;
+
+    //Since shader doesn't have a stack structure, implementing it with an array and a counter.
+    int nodeStack[MAX_STACK_DEPTH];
+    // Entry distance of the nodes on the stack.
+    float tStack[MAX_STACK_DEPTH];
+    int stackIndex = 0;
+
+    if (countBvhStats) bvhRaysTraced++;
+
+    // Traversing a flattened bvh using a stack.
+    // nodeStack[stackIndex] contains an index of AABB in bhv[]
+    // Nodes are in depth-first order, so the left child of a node is the next node in bvh[].
+    // Boxes of the children are tested before pushing them, so only the root is tested here.
+    vec2 tRoot = intersectAABB(r, bvh[0].min, bvh[0].max);
+    if (!traverseBox(tRoot, t_min, closest_so_far)) return false;
+
+    nodeStack[stackIndex] = 0;
+    tStack[stackIndex] = tRoot.x;
+    stackIndex++;
+
+    // Instances are traversed on the same stack: r is in object space of currentInstance until its EXIT_INSTANCE is popped.
+    ray worldRay = r;
+    int currentInstance = -1;
+
+    while (stackIndex > 0) {
+        stackIndex--;
+        // A hit closer than the node may have been found after it was pushed.
+        if (orderedTraversal && tStack[stackIndex] > closest_so_far) continue;
+        int currentNode = nodeStack[stackIndex];
+
+        if (currentNode == EXIT_INSTANCE) {
+            r = worldRay;
+            currentInstance = -1;
+            continue;
+        }
+        if (currentNode <= ENTER_INSTANCE) {
+            // Continue in the bvh of the mesh with the ray in object space. EXIT_INSTANCE is never culled.
+            int instanceIndex = ENTER_INSTANCE - currentNode;
+            int root = instances[instanceIndex].blasRoot;
+            ray objectRay = ray(transformPoint(instances[instanceIndex].worldToObject, worldRay.origin),
+                                transformVector(instances[instanceIndex].worldToObject, worldRay.dir));
+            vec2 tBlas = intersectAABB(objectRay, bvh[root].min, bvh[root].max);
+            if (!traverseBox(tBlas, t_min, closest_so_far) || stackIndex + 2 > MAX_STACK_DEPTH) continue;
+
+            r = objectRay;
+            currentInstance = instanceIndex;
+            nodeStack[stackIndex] = EXIT_INSTANCE;
+            tStack[stackIndex] = -1.0;
+            stackIndex++;
+            nodeStack[stackIndex] = root;
+            tStack[stackIndex] = tBlas.x;
+            stackIndex++;
+            continue;
+        }
+        if (countBvhStats) bvhNodesVisited++;
+
+        int offset = bvh[currentNode].offset;
+        int count = bvh[currentNode].count;
+        if ((count >> PRIMITIVE_TYPE_SHIFT) == INSTANCE_PRIMITIVE) {
+            // Leaf of the top level bvh, its instances are entered one by one.
+            float tLeaf = tStack[stackIndex];
+            for (int i = offset + (count & PRIMITIVE_COUNT_MASK) - 1; i >= offset && stackIndex < MAX_STACK_DEPTH; i--) {
+                nodeStack[stackIndex] = ENTER_INSTANCE - i;
+                tStack[stackIndex] = tLeaf;
+                stackIndex++;
+            }
+            continue;
+        }
+        if (count > 0) {
+            // Leaf node references a range of primitives starting at offset.
+            if (hit_leaf(offset, count, r, t_min, closest_so_far, rec)) {
+                hit_anything = true;
+                if (currentInstance >= 0) instanceHitToWorld(currentInstance, rec);
+            }
+            continue;
+        }
+
+        // Inner node, offset is the index of the right child.
+        int children[2] = {currentNode + 1, offset};
+        vec2 tChild[2] = {intersectAABB(r, bvh[children[0]].min, bvh[children[0]].max),
+                          intersectAABB(r, bvh[children[1]].min, bvh[children[1]].max)};
+
+        // Push the far child first, so the near one is popped next.
+        int near = orderedTraversal && tChild[1].x < tChild[0].x ? 1 : 0;
+        for (int i = 0; i < 2; i++) {
+            int c = i == 0 ? 1 - near : near;
+            if (!traverseBox(tChild[c], t_min, closest_so_far) || stackIndex == MAX_STACK_DEPTH) continue;
+            nodeStack[stackIndex] = children[c];
+            tStack[stackIndex] = tChild[c].x;
+            stackIndex++;
+        }
+    }
+
+    return hit_anything;
+}
+#endif
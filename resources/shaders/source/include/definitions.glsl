@@ -10,6 +10,11 @@ struct triangle {
     uint materialIndex;
 };
 
+// Triangle as an affine transform into the unit triangle space, see GpuModel::WoopTriangle. Rows are z, u and v.
+struct woopTriangle {
+    vec4 rows[3];
+};
+
 struct light {
     uint triangleIndex;
     float area;
@@ -20,14 +25,51 @@ struct sphere {
     uint materialIndex;
 };
 
+// Instance of a mesh with its own bvh, see GpuModel::Instance.
+struct instance {
+    // Rows of the 3x4 transforms between object space of the mesh and world space.
+    vec4 objectToWorld[3];
+    vec4 worldToObject[3];
+    // Index of the root node of the mesh bvh.
+    int blasRoot;
+    uint meshIndex;
+};
+
+// Bvh leaves hold primitives of one type, stored in the high bits of the leaf count. See GpuModel::PrimitiveTypeShift.
+#define TRIANGLE_PRIMITIVE 0
+#define SPHERE_PRIMITIVE 1
+#define INSTANCE_PRIMITIVE 2
+#define PRIMITIVE_TYPE_SHIFT 28
+#define PRIMITIVE_COUNT_MASK 0x0FFFFFFF
+
+// 32 byte bvh node, nodes are in depth-first order and the left child of an inner node is the next node.
 struct bvhNode {
     vec3 min;
+    // Inner node: index of the right child. Leaf: index of the first primitive in the array of its type.
+    int offset;
     vec3 max;
-    int leftNodeIndex;
-    int rightNodeIndex;
-    int objectIndex;
+    // Number and type of primitives in a leaf, 0 for inner nodes.
+    int count;
+};
+
+// Node of a 4-wide bvh, see GpuModel::WideBvhNode. Child boxes are stored per axis, one lane per child.
+struct wideBvhNode {
+    vec4 minX;
+    vec4 minY;
+    vec4 minZ;
+    vec4 maxX;
+    vec4 maxY;
+    vec4 maxZ;
+    // Index of the child node, or of the first primitive of a leaf child.
+    ivec4 child;
+    // Number and type of primitives of a leaf child, 0 for inner children and -1 for empty slots.
+    ivec4 count;
 };
 
+// Quantized bvh nodes are uvec4, see GpuModel::QuantizedBvhNode.
+// The last component is the index of the right child, or QUANTIZED_LEAF for leaves.
+#define QUANTIZED_LEAF 0xFFFFFFFFu
+
 struct onb {
     vec3 u;
     vec3 v;
@@ -4,11 +4,17 @@
 #include "vk_mem_alloc.h"
 #include "VulkanApplicationContext.h"
 
-VulkanApplicationContext::VulkanApplicationContext()
+VulkanApplicationContext::VulkanApplicationContext(bool headless) : m_headless(headless)
 {
-    initWindow();
+    if (!m_headless)
+    {
+        initWindow();
+    }
     createInstance();
-    createSurface();
+    if (!m_headless)
+    {
+        createSurface();
+    }
     createDevice();
 
     createCommandPool();
@@ -20,11 +26,17 @@ VulkanApplicationContext::~VulkanApplicationContext()
               << "\n";
     vkDestroyCommandPool(m_vkbDevice.device, m_commandPool, nullptr);
     vmaDestroyAllocator(m_allocator);
-    vkDestroySurfaceKHR(m_vkbInstance.instance, m_surface, nullptr);
+    if (!m_headless)
+    {
+        vkDestroySurfaceKHR(m_vkbInstance.instance, m_surface, nullptr);
+    }
 
     vkb::destroy_device(m_vkbDevice);
     vkb::destroy_instance(m_vkbInstance);
-    glfwDestroyWindow(m_window);
+    if (!m_headless)
+    {
+        glfwDestroyWindow(m_window);
+    }
 }
 
 void VulkanApplicationContext::initWindow()
@@ -52,6 +64,10 @@ void VulkanApplicationContext::createInstance()
                                        .request_validation_layers()
                                        .use_default_debug_messenger()
                                        .enable_extension(VK_KHR_GET_PHYSICAL_DEVICE_PROPERTIES_2_EXTENSION_NAME)
+                                       // Subgroup operations of the shader counters build need Vulkan 1.1.
+                                       .require_api_version(1, 1, 0)
+                                       // Headless instances don't need the surface extensions.
+                                       .set_headless(m_headless)
                                        .build();
     if (!instance_builder_return)
     {
@@ -62,11 +78,15 @@ void VulkanApplicationContext::createInstance()
 
 void VulkanApplicationContext::createDevice()
 {
+    // Any device type is accepted, so headless rendering also runs on software drivers like lavapipe.
     vkb::PhysicalDeviceSelector phys_device_selector(m_vkbInstance);
-    auto phys_dev_ret = phys_device_selector
-                            .add_desired_extension("VK_KHR_portability_subset")
-                            .set_surface(m_surface)
-                            .select();
+    phys_device_selector.add_desired_extension("VK_KHR_portability_subset");
+    phys_device_selector.set_minimum_version(1, 1);
+    if (!m_headless)
+    {
+        phys_device_selector.set_surface(m_surface);
+    }
+    auto phys_dev_ret = phys_device_selector.select();
     if (!phys_dev_ret)
     {
         throw std::runtime_error("Failed to create physical device. Error: " + phys_dev_ret.error().message());
@@ -101,12 +121,20 @@ void VulkanApplicationContext::createCommandPool()
     }
     m_graphicsQueue = g_queue_ret.value();
 
-    auto p_queue_ret = m_vkbDevice.get_queue(vkb::QueueType::present);
-    if (!p_queue_ret)
+    if (m_headless)
+    {
+        // Nothing is presented.
+        m_presentQueue = m_graphicsQueue;
+    }
+    else
     {
-        throw std::runtime_error("Failed to create present queue. Error: " + p_queue_ret.error().message());
+        auto p_queue_ret = m_vkbDevice.get_queue(vkb::QueueType::present);
+        if (!p_queue_ret)
+        {
+            throw std::runtime_error("Failed to create present queue. Error: " + p_queue_ret.error().message());
+        }
+        m_presentQueue = p_queue_ret.value();
     }
-    m_presentQueue = p_queue_ret.value();
 
     VkCommandPoolCreateInfo poolInfo{};
     poolInfo.sType = VK_STRUCTURE_TYPE_COMMAND_POOL_CREATE_INFO;
@@ -179,3 +207,8 @@ GLFWwindow *VulkanApplicationContext::getWindow() const
 {
     return m_window;
 }
+
+bool VulkanApplicationContext::isHeadless() const
+{
+    return m_headless;
+}
@@ -12,7 +12,8 @@ const uint32_t HEIGHT = 600;
 
 class VulkanApplicationContext {
     public:        
-        VulkanApplicationContext() ;
+        // A headless context has no window, surface or present queue, for rendering into offscreen images.
+        VulkanApplicationContext(bool headless = false) ;
 
         ~VulkanApplicationContext() ;
         
@@ -34,8 +35,11 @@ class VulkanApplicationContext {
 
         const vkb::Device& getVkbDevice() const;
 
+        // nullptr for a headless context.
         GLFWwindow* getWindow() const;
 
+        bool isHeadless() const;
+
     private:
         void initWindow() ;
 
@@ -48,9 +52,10 @@ class VulkanApplicationContext {
         void createCommandPool();
 
     private:
-        GLFWwindow* m_window;
+        bool m_headless;
+        GLFWwindow* m_window = nullptr;
+        VkSurfaceKHR m_surface = VK_NULL_HANDLE;
         vkb::Instance m_vkbInstance;
-        VkSurfaceKHR m_surface;
         VkQueue m_graphicsQueue;
         VkQueue m_presentQueue;
         VkCommandPool m_commandPool;
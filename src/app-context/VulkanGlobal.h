@@ -1,6 +1,13 @@
 namespace VulkanGlobal {
+#ifdef HEADLESS_RENDER
+    // Offscreen rendering without window, surface and swapchain, see renderOffscreen in main.cpp.
+    const VulkanApplicationContext context{true};
+
+    const VulkanSwapchain swapchainContext{true};
+#else
     // Application context - manages device, surface, queues and command pool.
     const VulkanApplicationContext context{};
 
     const VulkanSwapchain swapchainContext{};
+#endif
 }
\ No newline at end of file
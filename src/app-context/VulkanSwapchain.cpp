@@ -3,13 +3,20 @@
 #include <vector>
 #include <iostream>
 
-VulkanSwapchain::VulkanSwapchain()
+VulkanSwapchain::VulkanSwapchain(bool headless) : m_headless(headless)
 {
-    createSwapChain();
+    if (!m_headless)
+    {
+        createSwapChain();
+    }
 }
 
 VulkanSwapchain::~VulkanSwapchain()
 {
+    if (m_headless)
+    {
+        return;
+    }
     std::cout << "Destroying swapchain"
               << "\n";
     for (size_t i = 0; i < m_imageViews.size(); i++)
@@ -75,3 +82,8 @@ const std::vector<VkImageView> &VulkanSwapchain::getImageViews() const
 {
     return m_imageViews;
 }
+
+uint32_t VulkanSwapchain::getImageCount() const
+{
+    return m_headless ? 1 : static_cast<uint32_t>(m_images.size());
+}
@@ -8,7 +8,8 @@
 class VulkanSwapchain
 {
 public:
-    VulkanSwapchain();
+    // A headless swapchain has no images, it stands for a single offscreen frame.
+    VulkanSwapchain(bool headless = false);
     ~VulkanSwapchain();
 
     const VkSwapchainKHR &getBody() const;
@@ -16,11 +17,14 @@ public:
     const VkFormat &getFormat() const;
     const std::vector<VkImage> &getImages() const;
     const std::vector<VkImageView> &getImageViews() const;
+    // Number of frames with their own descriptor sets and command buffers, 1 for a headless swapchain.
+    uint32_t getImageCount() const;
 
 private:
     void createSwapChain();
 
 private:
+    bool m_headless;
     vkb::Swapchain m_vkbSwapchain;
     std::vector<VkImage> m_images;
     std::vector<VkImageView> m_imageViews;
@@ -4,6 +4,13 @@
 #include <vector>
 #include <array>
 #include <memory>
+#include <chrono>
+#include <string>
+#include <algorithm>
+#include <cmath>
+#include <fstream>
+#include <sstream>
+#include <limits>
 #include "utils/vulkan.h"
 #include "app-context/VulkanApplicationContext.h"
 #include "app-context/VulkanSwapchain.h"
@@ -20,6 +27,10 @@
 #include "scene/ComputeModel.h"
 #include "ray-tracing/RtScene.h"
 #include "memory/ImageUtils.h"
+#include "memory/StagingRing.h"
+#include "memory/BufferPool.h"
+#include "render-context/GpuProfiler.h"
+#include "utils/StbImageWriteImpl.h"
 // TODO: Organize includes!
 
 #include <stdint.h>
@@ -44,29 +55,454 @@ struct UniformBufferObject
     alignas(4) u_int32_t numTriangles;
     alignas(4) u_int32_t numLights;
     alignas(4) u_int32_t numSpheres;
+    // Box of the bvh root, only used by quantized bvh nodes.
+    alignas(16) glm::vec3 bvhMin;
+    alignas(16) glm::vec3 bvhMax;
 };
 
+// Configuration of the gpu benchmark, parsed from --name value pairs by parseBenchmarkOptions.
+struct BenchmarkOptions
+{
+    uint32_t width = 1280;
+    uint32_t height = 720;
+    // Measured frames, one sample per pixel each.
+    uint32_t samples = 64;
+    // Frames rendered before measuring, to warm up caches and clocks.
+    uint32_t warmupFrames = 8;
+    uint32_t bounces = 2;
+    std::string bvhLayout = "compact";
+    bool orderedTraversal = true;
+    std::string outputPath = "benchmark.json";
+    // Chrome trace of the measured frames, not written when empty.
+    std::string tracePath;
+};
+
+// gpu-benchmark [--width 1280] [--height 720] [--samples 64] [--warmup 8] [--bounces 2]
+//               [--layout compact|quantized|wide|roped] [--ordered 1] [--output benchmark.json] [--trace trace.json]
+BenchmarkOptions parseBenchmarkOptions(int argc, char **argv)
+{
+    BenchmarkOptions options;
+    for (int i = 1; i < argc; i += 2)
+    {
+        std::string name = argv[i];
+        if (i + 1 == argc)
+        {
+            throw std::runtime_error("missing value of " + name);
+        }
+        std::string value = argv[i + 1];
+        if (name == "--width")
+        {
+            options.width = std::stoul(value);
+        }
+        else if (name == "--height")
+        {
+            options.height = std::stoul(value);
+        }
+        else if (name == "--samples")
+        {
+            options.samples = std::stoul(value);
+        }
+        else if (name == "--warmup")
+        {
+            options.warmupFrames = std::stoul(value);
+        }
+        else if (name == "--bounces")
+        {
+            options.bounces = std::stoul(value);
+        }
+        else if (name == "--layout")
+        {
+            options.bvhLayout = value;
+        }
+        else if (name == "--ordered")
+        {
+            options.orderedTraversal = value != "0";
+        }
+        else if (name == "--output")
+        {
+            options.outputPath = value;
+        }
+        else if (name == "--trace")
+        {
+            options.tracePath = value;
+        }
+        else
+        {
+            throw std::runtime_error("unknown option " + name);
+        }
+    }
+    if (options.width == 0 || options.height == 0 || options.samples == 0 || options.bounces == 0)
+    {
+        throw std::runtime_error("width, height, samples and bounces must be positive!");
+    }
+    return options;
+}
+
 class HelloComputeApplication
 {
 public:
     void run()
     {
+        renderExtent = VulkanGlobal::swapchainContext.getExtent();
         initVulkan();
         mainLoop();
         cleanup();
     }
 
+    // Renders samples samples per pixel into an offscreen image of width x height and writes it to outputPath.
+    // Paths ending with .hdr get a Radiance HDR file with linear colors, anything else a PNG gamma corrected like the screen.
+    void renderOffscreen(uint32_t width, uint32_t height, uint32_t samples, const std::string &outputPath)
+    {
+        using namespace mcvkp;
+        renderExtent = {width, height};
+        initScene();
+        stagingRing.reset();
+        stagingBatch.reset();
+        rtScene->releaseGpuTriangles();
+
+        VkCommandBufferAllocateInfo allocInfo{};
+        allocInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_ALLOCATE_INFO;
+        allocInfo.commandPool = VulkanGlobal::context.getCommandPool();
+        allocInfo.level = VK_COMMAND_BUFFER_LEVEL_PRIMARY;
+        allocInfo.commandBufferCount = 1;
+        VkCommandBuffer commandBuffer;
+        if (vkAllocateCommandBuffers(VulkanGlobal::context.getDevice(), &allocInfo, &commandBuffer) != VK_SUCCESS)
+        {
+            throw std::runtime_error("failed to allocate command buffers!");
+        }
+        VkCommandBufferBeginInfo beginInfo{};
+        beginInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO;
+        vkBeginCommandBuffer(commandBuffer, &beginInfo);
+        if (bvhRefitModel)
+        {
+            recordBvhRefit(commandBuffer, 0);
+        }
+        recordRayTracing(commandBuffer, 0, computeModel);
+        if (vkEndCommandBuffer(commandBuffer) != VK_SUCCESS)
+        {
+            throw std::runtime_error("failed to record command buffer!");
+        }
+
+        VkFenceCreateInfo fenceInfo{};
+        fenceInfo.sType = VK_STRUCTURE_TYPE_FENCE_CREATE_INFO;
+        VkFence fence;
+        if (vkCreateFence(VulkanGlobal::context.getDevice(), &fenceInfo, nullptr, &fence) != VK_SUCCESS)
+        {
+            throw std::runtime_error("failed to create synchronization objects for a frame!");
+        }
+
+        auto startTime = std::chrono::high_resolution_clock::now();
+        for (uint32_t sample = 0; sample < samples; sample++)
+        {
+            // There is a single uniform region, so every sample waits for the previous one before writing it.
+            updateScene(0);
+
+            VkSubmitInfo submitInfo{};
+            submitInfo.sType = VK_STRUCTURE_TYPE_SUBMIT_INFO;
+            submitInfo.commandBufferCount = 1;
+            submitInfo.pCommandBuffers = &commandBuffer;
+            if (vkQueueSubmit(VulkanGlobal::context.getGraphicsQueue(), 1, &submitInfo, fence) != VK_SUCCESS)
+            {
+                throw std::runtime_error("failed to submit draw command buffer!");
+            }
+            vkWaitForFences(VulkanGlobal::context.getDevice(), 1, &fence, VK_TRUE, UINT64_MAX);
+            vkResetFences(VulkanGlobal::context.getDevice(), 1, &fence);
+
+            if ((sample + 1) % 64 == 0 || sample + 1 == samples)
+            {
+                std::chrono::duration<double> elapsed = std::chrono::high_resolution_clock::now() - startTime;
+                std::cout << "Rendered " << sample + 1 << "/" << samples << " samples in " << elapsed.count() << " s\n";
+            }
+        }
+        vkDestroyFence(VulkanGlobal::context.getDevice(), fence, nullptr);
+        vkFreeCommandBuffers(VulkanGlobal::context.getDevice(), VulkanGlobal::context.getCommandPool(), 1, &commandBuffer);
+
+        // Sample n writes the average into accumulationTextures[(n + 1) % 2].
+        auto &result = accumulationTextures[samples % 2];
+        size_t numValues = size_t(width) * height * 4;
+        Buffer readbackBuffer;
+        readbackBuffer.size = numValues * sizeof(float);
+        BufferUtils::allocate(&readbackBuffer, readbackBuffer.size, VK_BUFFER_USAGE_TRANSFER_DST_BIT, VMA_MEMORY_USAGE_GPU_TO_CPU);
+        ImageUtils::copyImageToBuffer(result->image, VK_IMAGE_LAYOUT_GENERAL, readbackBuffer.buffer, width, height);
+
+        std::vector<float> pixels(numValues);
+        void *data;
+        vmaMapMemory(VulkanGlobal::context.getAllocator(), readbackBuffer.allocation, &data);
+        vmaInvalidateAllocation(VulkanGlobal::context.getAllocator(), readbackBuffer.allocation, 0, VK_WHOLE_SIZE);
+        memcpy(pixels.data(), data, readbackBuffer.size);
+        vmaUnmapMemory(VulkanGlobal::context.getAllocator(), readbackBuffer.allocation);
+
+        bool written;
+        if (outputPath.size() >= 4 && outputPath.compare(outputPath.size() - 4, 4, ".hdr") == 0)
+        {
+            written = StbImageWriteImpl::writeHdr(outputPath, width, height, pixels.data());
+        }
+        else
+        {
+            // Same conversion as the unorm target texture and the gamma of post-process-shader.frag.
+            std::vector<unsigned char> bytes(numValues);
+            for (size_t i = 0; i < numValues; i++)
+            {
+                float value = std::min(std::max(pixels[i], 0.0f), 1.0f);
+                if (i % 4 != 3)
+                {
+                    value = std::pow(value, 1.0f / 2.2f);
+                }
+                else
+                {
+                    value = 1.0f;
+                }
+                bytes[i] = static_cast<unsigned char>(value * 255.0f + 0.5f);
+            }
+            written = StbImageWriteImpl::writePng(outputPath, width, height, bytes.data());
+        }
+        if (!written)
+        {
+            throw std::runtime_error("failed to write " + outputPath);
+        }
+        std::cout << "Wrote " << outputPath << "\n";
+
+        if (SHADER_COUNTERS)
+        {
+            lastBvhStats = readBvhStats(0);
+            printShaderCounters();
+            writeHeatmap(HEATMAP_PATH, 0);
+        }
+    }
+
+    // Renders options.warmupFrames frames and then options.samples measured frames offscreen, and writes the GPU time
+    // of every pass from timestamp queries, rays per second and the bvh nodes and triangles tested per ray as JSON.
+    // Per ray statistics come from one more frame rendered with countBvhStats, so their atomics don't slow down the measured frames.
+    void runGpuBenchmark(const BenchmarkOptions &options)
+    {
+        using namespace mcvkp;
+        const std::string layoutNames[] = {"compact", "quantized", "wide", "roped"};
+        int layoutIndex = std::find(std::begin(layoutNames), std::end(layoutNames), options.bvhLayout) - std::begin(layoutNames);
+        if (layoutIndex == std::end(layoutNames) - std::begin(layoutNames))
+        {
+            throw std::runtime_error("unknown bvh layout " + options.bvhLayout);
+        }
+
+        rtScene = std::make_shared<GpuModel::Scene>();
+        rtScene->bvhLayout = GpuModel::BvhLayout(layoutIndex);
+        if (rtScene->bvhLayout != GpuModel::BvhLayout::Compact && !rtScene->instances.empty())
+        {
+            throw std::runtime_error("only the compact bvh layout supports instances!");
+        }
+        rtScene->updateBvhLayout();
+        renderExtent = {options.width, options.height};
+        numBounces = options.bounces;
+        initScene();
+        stagingRing.reset();
+        stagingBatch.reset();
+
+        auto benchmarkModel = std::make_shared<ComputeModel>(createRayTracingMaterial(sceneBvhBuffer, sceneRayTracingShader, options.orderedTraversal, false, WOOP_TRIANGLES));
+        auto statsModel = std::make_shared<ComputeModel>(createRayTracingMaterial(sceneBvhBuffer, sceneRayTracingShader, options.orderedTraversal, true, WOOP_TRIANGLES));
+        // Keeps the times of all measured frames.
+        GpuProfiler profiler(1, 16, options.samples);
+        if (!profiler.enabled())
+        {
+            throw std::runtime_error("the gpu benchmark needs timestamp queries!");
+        }
+
+        VkDevice device = VulkanGlobal::context.getDevice();
+        std::array<VkCommandBuffer, 2> frameCommandBuffers;
+        VkCommandBufferAllocateInfo allocInfo{};
+        allocInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_ALLOCATE_INFO;
+        allocInfo.commandPool = VulkanGlobal::context.getCommandPool();
+        allocInfo.level = VK_COMMAND_BUFFER_LEVEL_PRIMARY;
+        allocInfo.commandBufferCount = frameCommandBuffers.size();
+        if (vkAllocateCommandBuffers(device, &allocInfo, frameCommandBuffers.data()) != VK_SUCCESS)
+        {
+            throw std::runtime_error("failed to allocate command buffers!");
+        }
+        VkCommandBuffer statsCommandBuffer = frameCommandBuffers[0];
+        VkCommandBuffer timedCommandBuffer = frameCommandBuffers[1];
+        for (VkCommandBuffer commandBuffer : frameCommandBuffers)
+        {
+            // Only the measured frames are profiled.
+            GpuProfiler *frameProfiler = commandBuffer == timedCommandBuffer ? &profiler : nullptr;
+            VkCommandBufferBeginInfo beginInfo{};
+            beginInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO;
+            vkBeginCommandBuffer(commandBuffer, &beginInfo);
+            recordFrame(commandBuffer, 0, frameProfiler ? benchmarkModel : statsModel, frameProfiler);
+            if (vkEndCommandBuffer(commandBuffer) != VK_SUCCESS)
+            {
+                throw std::runtime_error("failed to record command buffer!");
+            }
+        }
+
+        VkFenceCreateInfo fenceInfo{};
+        fenceInfo.sType = VK_STRUCTURE_TYPE_FENCE_CREATE_INFO;
+        VkFence fence;
+        if (vkCreateFence(device, &fenceInfo, nullptr, &fence) != VK_SUCCESS)
+        {
+            throw std::runtime_error("failed to create synchronization objects for a frame!");
+        }
+        // Renders one frame and waits for it, returns the time from the submission to the end of the wait.
+        auto renderFrame = [&](VkCommandBuffer commandBuffer) {
+            updateScene(0);
+            VkSubmitInfo submitInfo{};
+            submitInfo.sType = VK_STRUCTURE_TYPE_SUBMIT_INFO;
+            submitInfo.commandBufferCount = 1;
+            submitInfo.pCommandBuffers = &commandBuffer;
+            auto startTime = std::chrono::high_resolution_clock::now();
+            if (vkQueueSubmit(VulkanGlobal::context.getGraphicsQueue(), 1, &submitInfo, fence) != VK_SUCCESS)
+            {
+                throw std::runtime_error("failed to submit draw command buffer!");
+            }
+            vkWaitForFences(device, 1, &fence, VK_TRUE, UINT64_MAX);
+            std::chrono::duration<double, std::milli> frameTime = std::chrono::high_resolution_clock::now() - startTime;
+            vkResetFences(device, 1, &fence);
+            return frameTime.count();
+        };
+
+        for (uint32_t frame = 0; frame < options.warmupFrames; frame++)
+        {
+            renderFrame(timedCommandBuffer);
+        }
+
+        GpuProfiler::Stats frameStats{std::numeric_limits<double>::max(), 0.0, 0.0};
+        for (uint32_t frame = 0; frame < options.samples; frame++)
+        {
+            double frameTime = renderFrame(timedCommandBuffer);
+            profiler.collect(0);
+            frameStats.minMs = std::min(frameStats.minMs, frameTime);
+            frameStats.maxMs = std::max(frameStats.maxMs, frameTime);
+            frameStats.avgMs += frameTime / options.samples;
+        }
+
+        clearBvhStats(0);
+        renderFrame(statsCommandBuffer);
+        GpuModel::BvhStats stats = readBvhStats(0);
+
+        vkDestroyFence(device, fence, nullptr);
+        vkFreeCommandBuffers(device, VulkanGlobal::context.getCommandPool(), frameCommandBuffers.size(), frameCommandBuffers.data());
+
+        auto statsJson = [](const GpuProfiler::Stats &times) {
+            std::ostringstream json;
+            json << "{\"avg\": " << times.avgMs << ", \"min\": " << times.minMs << ", \"max\": " << times.maxMs << "}";
+            return json.str();
+        };
+        double rayTracingTime = profiler.getStats("ray tracing").avgMs;
+        uint32_t raysTraced = std::max(stats.raysTraced, 1u);
+
+        VkPhysicalDeviceProperties properties;
+        vkGetPhysicalDeviceProperties(VulkanGlobal::context.getPhysicalDevice(), &properties);
+        std::ofstream json(options.outputPath);
+        json << "{\n"
+             << "  \"device\": \"" << properties.deviceName << "\",\n"
+             << "  \"scene\": {\"triangles\": " << rtScene->gpuMaterialIndices.size() << ", \"spheres\": " << rtScene->spheres.size()
+             << ", \"instances\": " << rtScene->instances.size() << ", \"bvhNodes\": " << rtScene->compactBvhNodes.size() << "},\n"
+             << "  \"config\": {\"width\": " << options.width << ", \"height\": " << options.height << ", \"samples\": " << options.samples
+             << ", \"warmupFrames\": " << options.warmupFrames << ", \"bounces\": " << options.bounces << ", \"bvhLayout\": \"" << options.bvhLayout
+             << "\", \"orderedTraversal\": " << (options.orderedTraversal ? "true" : "false") << ", \"woopTriangles\": " << (WOOP_TRIANGLES ? "true" : "false") << "},\n"
+             << "  \"gpuTimeMs\": {";
+        std::vector<std::string> scopeNames = profiler.getScopeNames();
+        for (size_t i = 0; i < scopeNames.size(); i++)
+        {
+            json << (i > 0 ? ", " : "") << "\"" << scopeNames[i] << "\": " << statsJson(profiler.getStats(scopeNames[i]));
+        }
+        json << "},\n"
+             << "  \"frameTimeMs\": " << statsJson(frameStats) << ",\n"
+             << "  \"raysPerFrame\": " << stats.raysTraced << ",\n"
+             << "  \"raysPerSecond\": " << stats.raysTraced / (rayTracingTime * 1e-3) << ",\n"
+             << "  \"nodesPerRay\": " << double(stats.nodesVisited) / raysTraced << ",\n"
+             << "  \"trianglesPerRay\": " << double(stats.trianglesTested) / raysTraced << "\n"
+             << "}\n";
+        json.close();
+        if (!json)
+        {
+            throw std::runtime_error("failed to write " + options.outputPath);
+        }
+        if (!options.tracePath.empty() && !profiler.writeChromeTrace(options.tracePath))
+        {
+            throw std::runtime_error("failed to write " + options.tracePath);
+        }
+        std::cout << "Wrote " << options.outputPath << "\n";
+    }
+
 private:
     std::shared_ptr<GpuModel::Scene> rtScene;
 
+    // Upload the static scene buffers into device local memory, see createStaticBuffer.
+    // Both are released once the scene is uploaded.
+    std::shared_ptr<mcvkp::StagingRing> stagingRing;
+    std::shared_ptr<mcvkp::StagingBatch> stagingBatch;
+    // Small static buffers are ranges of a few shared arenas instead of allocations of their own.
+    std::shared_ptr<mcvkp::BufferPool> staticBufferPool;
+
+    // Buffers and images shared by all ray tracing materials. Only the uniforms have a region per swapchain image,
+    // every descriptor set binds the same storage buffers.
+    std::shared_ptr<mcvkp::UniformRing> uniformRing;
+    // Triangles are indices into a shared vertex buffer, their materials are stored separately.
+    std::shared_ptr<mcvkp::Buffer> vertexBuffer;
+    std::shared_ptr<mcvkp::Buffer> triangleIndexBuffer;
+    std::shared_ptr<mcvkp::Buffer> triangleMaterialBuffer;
+    // Triangles precomputed for the intersection test, only filled when WOOP_TRIANGLES or BVH_BENCHMARK is set.
+    std::shared_ptr<mcvkp::Buffer> woopTriangleBuffer;
+    std::shared_ptr<mcvkp::Buffer> materialBuffer;
+    std::shared_ptr<mcvkp::Buffer> lightsBuffer;
+    std::shared_ptr<mcvkp::Buffer> spheresBuffer;
+    std::shared_ptr<mcvkp::BufferBundle> bvhStatsBundle;
+    std::shared_ptr<mcvkp::Buffer> instancesBuffer;
+    // Only created with SHADER_COUNTERS.
+    std::shared_ptr<mcvkp::BufferBundle> pixelCostBundle;
+    // Statistics of the last finished frame, only read with SHADER_COUNTERS.
+    GpuModel::BvhStats lastBvhStats;
+    // Bvh of rtScene in the layout of rtScene->bvhLayout and the ray tracing shader reading it.
+    std::shared_ptr<mcvkp::Buffer> sceneBvhBuffer;
+    std::string sceneRayTracingShader;
+    // Float running average of the samples, every frame reads one and writes the other, see ray-trace-compute.comp.
+    std::array<std::shared_ptr<mcvkp::Image>, 2> accumulationTextures;
+    std::shared_ptr<mcvkp::Image> targetTexture;
+
     std::shared_ptr<mcvkp::ComputeModel> computeModel;
 
+    // Refits the bvh to the triangle buffer, only created when REFIT_BVH_ON_GPU is set.
+    std::shared_ptr<mcvkp::ComputeModel> bvhRefitModel;
+
     std::shared_ptr<mcvkp::Scene> postProcessScene;
 
     std::vector<VkCommandBuffer> commandBuffers;
+    // Times the passes of commandBuffers.
+    std::shared_ptr<mcvkp::GpuProfiler> gpuProfiler;
 
     const int MAX_FRAMES_IN_FLIGHT = 2;
 
+    // Refit the bvh on GPU before every frame. Only needed when the vertex buffer is written between frames, the demo
+    // scene doesn't move. GpuModel::Scene::updateBvh tells when the topology is too degraded and the bvh has to be rebuilt instead.
+    const bool REFIT_BVH_ON_GPU = false;
+
+    // Render one frame with every bvh layout, traversal and triangle format on startup
+    // and print the number of nodes visited per ray and the frame time. Also renders a scene with instances,
+    // and the scene with moving triangles whose bvh is refit or rebuilt by GpuModel::Scene::updateBvh.
+    const bool BVH_BENCHMARK = false;
+
+    // Intersect triangles in the precomputed format of Woop et al. instead of triangles from the vertex buffer.
+    // Saves ALU per triangle test, at the cost of 48 more bytes per triangle.
+    const bool WOOP_TRIANGLES = false;
+
+    // Write the GPU times of the last frames to GPU_TRACE_PATH on exit, in the Chrome trace format.
+    const bool WRITE_GPU_TRACE = false;
+    const std::string GPU_TRACE_PATH = "gpu-trace.json";
+
+    // Use the shader counters build of the ray tracing shaders, see compile.sh. It counts rays, bvh nodes, triangle tests
+    // and how paths end with subgroup reduced atomics, prints the totals of a frame once a second
+    // and writes a heatmap of the traversal cost per pixel of the last frame to HEATMAP_PATH.
+    const bool SHADER_COUNTERS = false;
+    const std::string HEATMAP_PATH = "heatmap.png";
+
+    // Keep the static scene buffers in host visible memory instead of device local memory,
+    // to measure what device local memory gains with the bvh benchmark.
+    const bool HOST_VISIBLE_SCENE_BUFFERS = false;
+
+    // Maximum number of bounces of a path in the ray tracing shader.
+    uint32_t numBounces = 2;
+
+    // Size of the ray traced image, the swapchain extent unless rendering offscreen.
+    VkExtent2D renderExtent;
+
     std::vector<VkSemaphore> imageAvailableSemaphores;
     std::vector<VkSemaphore> renderFinishedSemaphores;
     std::vector<VkFence> inFlightFences;
@@ -76,60 +512,74 @@ private:
     void initScene()
     {
         using namespace mcvkp;
-        uint32_t descriptorSetsSize = VulkanGlobal::swapchainContext.getImageViews().size();
+        uint32_t descriptorSetsSize = VulkanGlobal::swapchainContext.getImageCount();
 
-        rtScene = std::make_shared<GpuModel::Scene>();
-
-        // Buffer bundle is an array of buffers, one per each swapchain image/descriptor set.
-        auto uniformBufferBundle = std::make_shared<mcvkp::BufferBundle>(descriptorSetsSize);
-        BufferUtils::createBundle<UniformBufferObject>(uniformBufferBundle.get(), UniformBufferObject(),
-                                                       VK_BUFFER_USAGE_UNIFORM_BUFFER_BIT, VMA_MEMORY_USAGE_CPU_TO_GPU);
+        // The gpu benchmark creates the scene before to pick its bvh layout.
+        if (!rtScene)
+        {
+            rtScene = std::make_shared<GpuModel::Scene>();
+        }
+        stagingRing = std::make_shared<StagingRing>();
+        stagingBatch = std::make_shared<StagingBatch>();
+        staticBufferPool = std::make_shared<BufferPool>(VK_BUFFER_USAGE_STORAGE_BUFFER_BIT | VK_BUFFER_USAGE_TRANSFER_DST_BIT, VMA_MEMORY_USAGE_GPU_ONLY);
 
-        auto triangleBufferBundle = std::make_shared<mcvkp::BufferBundle>(descriptorSetsSize);
-        BufferUtils::createBundle<GpuModel::Triangle>(triangleBufferBundle.get(), rtScene->triangles.data(), rtScene->triangles.size(),
-                                                      VK_BUFFER_USAGE_STORAGE_BUFFER_BIT, VMA_MEMORY_USAGE_CPU_TO_GPU);
+        // One region per swapchain image, written by updateScene before the command buffer of the image is submitted.
+        uniformRing = std::make_shared<mcvkp::UniformRing>(descriptorSetsSize);
 
-        auto materialBufferBundle = std::make_shared<mcvkp::BufferBundle>(descriptorSetsSize);
-        BufferUtils::createBundle<GpuModel::Material>(materialBufferBundle.get(), rtScene->materials.data(), rtScene->materials.size(),
-                                                      VK_BUFFER_USAGE_STORAGE_BUFFER_BIT, VMA_MEMORY_USAGE_CPU_TO_GPU);
+        createSceneBuffers();
 
-        auto aabbBufferBundle = std::make_shared<mcvkp::BufferBundle>(descriptorSetsSize);
-        BufferUtils::createBundle<GpuModel::BvhNode>(aabbBufferBundle.get(), rtScene->bvhNodes.data(), rtScene->bvhNodes.size(),
-                                                     VK_BUFFER_USAGE_STORAGE_BUFFER_BIT, VMA_MEMORY_USAGE_CPU_TO_GPU);
+        // Read back by the bvh benchmarks and by the shader counters build after every frame, so it stays host visible.
+        // Every swapchain image has its own statistics, so a frame in flight never overwrites what is read back from a finished one.
+        GpuModel::BvhStats bvhStats;
+        bvhStatsBundle = std::make_shared<BufferBundle>(descriptorSetsSize);
+        BufferUtils::createBundle<GpuModel::BvhStats>(bvhStatsBundle.get(), bvhStats, VK_BUFFER_USAGE_STORAGE_BUFFER_BIT | VK_BUFFER_USAGE_TRANSFER_DST_BIT,
+                                                      VMA_MEMORY_USAGE_GPU_TO_CPU);
 
-        auto lightsBufferBundle = std::make_shared<mcvkp::BufferBundle>(descriptorSetsSize);
-        BufferUtils::createBundle<GpuModel::Light>(lightsBufferBundle.get(), rtScene->lights.data(), rtScene->lights.size(),
-                                                   VK_BUFFER_USAGE_STORAGE_BUFFER_BIT, VMA_MEMORY_USAGE_CPU_TO_GPU);
+        if (SHADER_COUNTERS)
+        {
+            requireSubgroupArithmetic();
+            // Pixel costs are per swapchain image like the statistics, they are only read on exit.
+            pixelCostBundle = std::make_shared<BufferBundle>(descriptorSetsSize);
+            for (uint32_t i = 0; i < descriptorSetsSize; i++)
+            {
+                auto &pixelCostBuffer = pixelCostBundle->buffers[i];
+                pixelCostBuffer->size = size_t(renderExtent.width) * renderExtent.height * sizeof(uint32_t);
+                BufferUtils::allocate(pixelCostBuffer.get(), pixelCostBuffer->size, VK_BUFFER_USAGE_STORAGE_BUFFER_BIT, VMA_MEMORY_USAGE_GPU_TO_CPU);
+            }
+        }
 
-        auto spheresBufferBundle = std::make_shared<mcvkp::BufferBundle>(descriptorSetsSize);
-        BufferUtils::createBundle<GpuModel::Sphere>(spheresBufferBundle.get(), rtScene->spheres.data(), rtScene->spheres.size(),
-                                                    VK_BUFFER_USAGE_STORAGE_BUFFER_BIT, VMA_MEMORY_USAGE_CPU_TO_GPU);
+        sceneBvhBuffer = createBvhBuffer(sceneRayTracingShader);
 
-        auto accumulationTexture = std::make_shared<mcvkp::Image>();
-        mcvkp::ImageUtils::createImage(VulkanGlobal::swapchainContext.getExtent().width,
-                                       VulkanGlobal::swapchainContext.getExtent().height,
-                                       1,
-                                       VK_SAMPLE_COUNT_1_BIT,
-                                       VK_FORMAT_R8G8B8A8_UNORM,
-                                       VK_IMAGE_TILING_OPTIMAL,
-                                       VK_IMAGE_USAGE_SAMPLED_BIT | VK_IMAGE_USAGE_STORAGE_BIT | VK_IMAGE_USAGE_TRANSFER_DST_BIT,
-                                       VK_IMAGE_ASPECT_COLOR_BIT,
-                                       VMA_MEMORY_USAGE_GPU_ONLY,
-                                       accumulationTexture);
-        mcvkp::ImageUtils::transitionImageLayout(accumulationTexture->image,
-                                                 VK_FORMAT_R8G8B8A8_UNORM,
-                                                 VK_IMAGE_LAYOUT_UNDEFINED,
-                                                 VK_IMAGE_LAYOUT_GENERAL,
-                                                 1);
+        for (auto &accumulationTexture : accumulationTextures)
+        {
+            accumulationTexture = std::make_shared<mcvkp::Image>();
+            mcvkp::ImageUtils::createImage(renderExtent.width,
+                                           renderExtent.height,
+                                           1,
+                                           VK_SAMPLE_COUNT_1_BIT,
+                                           VK_FORMAT_R32G32B32A32_SFLOAT,
+                                           VK_IMAGE_TILING_OPTIMAL,
+                                           // Read back by renderOffscreen.
+                                           VK_IMAGE_USAGE_STORAGE_BIT | VK_IMAGE_USAGE_TRANSFER_SRC_BIT,
+                                           VK_IMAGE_ASPECT_COLOR_BIT,
+                                           VMA_MEMORY_USAGE_GPU_ONLY,
+                                           accumulationTexture);
+            // Stays in the general layout, it is only accessed by the ray tracing shader.
+            mcvkp::ImageUtils::transitionImageLayout(accumulationTexture->image,
+                                                     VK_FORMAT_R32G32B32A32_SFLOAT,
+                                                     VK_IMAGE_LAYOUT_UNDEFINED,
+                                                     VK_IMAGE_LAYOUT_GENERAL,
+                                                     1);
+        }
 
-        auto targetTexture = std::make_shared<mcvkp::Image>();
-        mcvkp::ImageUtils::createImage(VulkanGlobal::swapchainContext.getExtent().width,
-                                       VulkanGlobal::swapchainContext.getExtent().height,
+        targetTexture = std::make_shared<mcvkp::Image>();
+        mcvkp::ImageUtils::createImage(renderExtent.width,
+                                       renderExtent.height,
                                        1,
                                        VK_SAMPLE_COUNT_1_BIT,
                                        VK_FORMAT_R8G8B8A8_UNORM,
                                        VK_IMAGE_TILING_OPTIMAL,
-                                       VK_IMAGE_USAGE_SAMPLED_BIT | VK_IMAGE_USAGE_STORAGE_BIT | VK_IMAGE_USAGE_TRANSFER_SRC_BIT,
+                                       VK_IMAGE_USAGE_SAMPLED_BIT | VK_IMAGE_USAGE_STORAGE_BIT,
                                        VK_IMAGE_ASPECT_COLOR_BIT,
                                        VMA_MEMORY_USAGE_GPU_ONLY,
                                        targetTexture);
@@ -140,64 +590,580 @@ private:
                                                  1);
 
         // Uncomment to use a simplified shader.
-        //auto computeMaterial = std::make_shared<ComputeMaterial>(path_prefix + "/shaders/generated/ray-trace-compute-simple.spv");
-        auto computeMaterial = std::make_shared<ComputeMaterial>(path_prefix + "/shaders/generated/ray-trace-compute.spv");
-        computeMaterial->addUniformBufferBundle(uniformBufferBundle, VK_SHADER_STAGE_COMPUTE_BIT);
+        //sceneRayTracingShader = "ray-trace-compute-simple.spv";
+        computeModel = std::make_shared<ComputeModel>(createRayTracingMaterial(sceneBvhBuffer, sceneRayTracingShader, true, false, WOOP_TRIANGLES));
+
+        if (REFIT_BVH_ON_GPU)
+        {
+            if (rtScene->bvhLayout != GpuModel::BvhLayout::Compact || !rtScene->instances.empty())
+            {
+                throw std::runtime_error("bvh refit on GPU needs the compact bvh layout without instances!");
+            }
+            if (WOOP_TRIANGLES)
+            {
+                throw std::runtime_error("bvh refit on GPU doesn't update woop triangles!");
+            }
+            std::vector<int> parents = Bvh::parentIndices(std::vector<GpuModel::CompactBvhNode>(rtScene->compactBvhNodes.begin(), rtScene->compactBvhNodes.end()));
+            auto parentsBuffer = createStaticBuffer(parents.data(), parents.size());
+
+            // Counters are cleared with vkCmdFillBuffer before every refit.
+            std::vector<uint32_t> refitCounters(rtScene->compactBvhNodes.size(), 0);
+            auto refitCountersBuffer = std::make_shared<mcvkp::Buffer>();
+            BufferUtils::create<uint32_t>(refitCountersBuffer.get(), refitCounters.data(), refitCounters.size(),
+                                          VK_BUFFER_USAGE_STORAGE_BUFFER_BIT | VK_BUFFER_USAGE_TRANSFER_DST_BIT, VMA_MEMORY_USAGE_CPU_TO_GPU);
+
+            auto refitMaterial = std::make_shared<ComputeMaterial>(path_prefix + "/shaders/generated/bvh-refit.spv");
+            refitMaterial->addStorageBuffer(vertexBuffer, VK_SHADER_STAGE_COMPUTE_BIT);
+            refitMaterial->addStorageBuffer(sceneBvhBuffer, VK_SHADER_STAGE_COMPUTE_BIT);
+            refitMaterial->addStorageBuffer(parentsBuffer, VK_SHADER_STAGE_COMPUTE_BIT);
+            refitMaterial->addStorageBuffer(refitCountersBuffer, VK_SHADER_STAGE_COMPUTE_BIT);
+            refitMaterial->addStorageBuffer(spheresBuffer, VK_SHADER_STAGE_COMPUTE_BIT);
+            refitMaterial->addStorageBuffer(triangleIndexBuffer, VK_SHADER_STAGE_COMPUTE_BIT);
+            bvhRefitModel = std::make_shared<ComputeModel>(refitMaterial);
+        }
+
+        // Offscreen rendering reads the result back instead of drawing it to the swapchain.
+        if (!VulkanGlobal::context.isHeadless())
+        {
+            postProcessScene = std::make_shared<Scene>(RenderPassType::eFlat);
+
+            auto screenTex = std::make_shared<Texture>(targetTexture);
+            auto screenMaterial = std::make_shared<Material>(
+                path_prefix + "/shaders/generated/post-process-vert.spv",
+                path_prefix + "/shaders/generated/post-process-frag.spv");
+            screenMaterial->addTexture(screenTex, VK_SHADER_STAGE_FRAGMENT_BIT);
+            postProcessScene->addModel(std::make_shared<DrawableModel>(screenMaterial, MeshType::ePlane));
+        }
+
+        stagingBatch->submit();
+        std::cout << "Static buffer pool: " << staticBufferPool->getRangeCount() << " buffers in " << staticBufferPool->getArenaCount() << " arenas\n";
+    }
+
+    // Uploads the primitives, materials and lights of rtScene, everything the ray tracing shader reads except the bvh.
+    void createSceneBuffers()
+    {
+        // Scene triangles followed by the triangles of instanced meshes. A scene loaded from the cache is streamed
+        // to the GPU straight from the mapped cache file.
+        vertexBuffer = createStaticBuffer(rtScene->gpuVertices.data(), rtScene->gpuVertices.size());
+
+        triangleIndexBuffer = createStaticBuffer(rtScene->gpuIndices.data(), rtScene->gpuIndices.size());
+
+        triangleMaterialBuffer = createStaticBuffer(rtScene->gpuMaterialIndices.data(), rtScene->gpuMaterialIndices.size());
+
+        size_t indexedBytes = rtScene->gpuVertices.size() * sizeof(glm::vec4) +
+                              (rtScene->gpuIndices.size() + rtScene->gpuMaterialIndices.size()) * sizeof(uint32_t);
+        std::cout << "Triangles: " << rtScene->gpuMaterialIndices.size() << " triangles, " << rtScene->gpuVertices.size() << " vertices, "
+                  << indexedBytes << " bytes indexed, " << rtScene->gpuMaterialIndices.size() * sizeof(GpuModel::Triangle) << " bytes unindexed\n";
+
+        materialBuffer = createStaticBuffer(rtScene->materials.data(), rtScene->materials.size());
+
+        lightsBuffer = createStaticBuffer(rtScene->lights.data(), rtScene->lights.size());
+
+        spheresBuffer = createStaticBuffer(rtScene->spheres.data(), rtScene->spheres.size());
+
+        // Buffers can't be empty, the unused one gets a single triangle.
+        std::vector<GpuModel::WoopTriangle> woopTriangles(1);
+        if (WOOP_TRIANGLES || BVH_BENCHMARK)
+        {
+            woopTriangles = rtScene->woopTriangles();
+        }
+        woopTriangleBuffer = createStaticBuffer(woopTriangles.data(), woopTriangles.size());
+
+        createInstancesBuffer();
+    }
+
+    // Uploads the instances of rtScene, also after setInstanceTransform moved one.
+    void createInstancesBuffer()
+    {
+        // Buffers can't be empty, scenes without instances get one that is never referenced by the bvh.
+        std::vector<GpuModel::Instance> instances = rtScene->instances;
+        if (instances.empty())
+        {
+            instances.push_back(GpuModel::Instance());
+        }
+        instancesBuffer = createStaticBuffer(instances.data(), instances.size());
+    }
+
+    // Uploads the bvh of rtScene in its GPU layout and sets rayTracingShader to the shader reading this layout.
+    std::shared_ptr<mcvkp::Buffer> createBvhBuffer(std::string &rayTracingShader)
+    {
+        std::shared_ptr<mcvkp::Buffer> aabbBuffer;
+        rayTracingShader = "ray-trace-compute.spv";
+        if (rtScene->bvhLayout == GpuModel::BvhLayout::Quantized)
+        {
+            aabbBuffer = createStaticBuffer(rtScene->quantizedBvhNodes.data(), rtScene->quantizedBvhNodes.size());
+            rayTracingShader = "ray-trace-compute-quantized.spv";
+        }
+        else if (rtScene->bvhLayout == GpuModel::BvhLayout::Wide)
+        {
+            aabbBuffer = createStaticBuffer(rtScene->wideBvhNodes.data(), rtScene->wideBvhNodes.size());
+            rayTracingShader = "ray-trace-compute-wide.spv";
+        }
+        else if (rtScene->bvhLayout == GpuModel::BvhLayout::Roped)
+        {
+            // Same node struct as the compact layout, the traversal is selected by a specialization constant.
+            aabbBuffer = createStaticBuffer(rtScene->ropedBvhNodes.data(), rtScene->ropedBvhNodes.size());
+        }
+        else
+        {
+            aabbBuffer = createStaticBuffer(rtScene->compactBvhNodes.data(), rtScene->compactBvhNodes.size());
+        }
+
+        if (SHADER_COUNTERS)
+        {
+            rayTracingShader.insert(rayTracingShader.size() - std::string(".spv").size(), "-counters");
+        }
+
+        // The bvh benchmark renders right after uploading.
+        stagingBatch->submit();
+        return aabbBuffer;
+    }
+
+    // Creates a storage buffer that doesn't change after the upload, in device local memory unless
+    // HOST_VISIBLE_SCENE_BUFFERS is set. Buffers that grow with the scene are streamed through stagingRing,
+    // small ones are ranges of staticBufferPool, batched by stagingBatch and only filled once it is submitted.
+    // A single copy is bound to the descriptor sets of all swapchain images.
+    template <typename T>
+    std::shared_ptr<mcvkp::Buffer> createStaticBuffer(const T *elements, size_t numElements)
+    {
+        using namespace mcvkp;
+        const size_t streamingThreshold = 64 * 1024;
+
+        if (!HOST_VISIBLE_SCENE_BUFFERS && numElements * sizeof(T) < streamingThreshold)
+        {
+            return staticBufferPool->create(elements, numElements, *stagingBatch);
+        }
+
+        auto buffer = std::make_shared<Buffer>();
+        if (HOST_VISIBLE_SCENE_BUFFERS)
+        {
+            BufferUtils::create<T>(buffer.get(), elements, numElements, VK_BUFFER_USAGE_STORAGE_BUFFER_BIT, VMA_MEMORY_USAGE_CPU_TO_GPU);
+        }
+        else
+        {
+            BufferUtils::createDeviceLocal<T>(buffer.get(), elements, numElements, VK_BUFFER_USAGE_STORAGE_BUFFER_BIT, *stagingRing);
+        }
+        return buffer;
+    }
+
+    // Creates a ray tracing material on the shared buffers, with the traversal selected by specialization constants.
+    std::shared_ptr<mcvkp::ComputeMaterial> createRayTracingMaterial(const std::shared_ptr<mcvkp::Buffer> &aabbBuffer,
+                                                                     const std::string &rayTracingShader,
+                                                                     bool orderedTraversal,
+                                                                     bool countBvhStats,
+                                                                     bool woopTriangles)
+    {
+        using namespace mcvkp;
+        auto computeMaterial = std::make_shared<ComputeMaterial>(path_prefix + "/shaders/generated/" + rayTracingShader);
+        computeMaterial->addUniformRing(uniformRing, VK_SHADER_STAGE_COMPUTE_BIT);
         computeMaterial->addStorageImage(targetTexture, VK_SHADER_STAGE_COMPUTE_BIT);
-        computeMaterial->addStorageImage(accumulationTexture, VK_SHADER_STAGE_COMPUTE_BIT);
-        computeMaterial->addStorageBufferBundle(triangleBufferBundle, VK_SHADER_STAGE_COMPUTE_BIT);
-        computeMaterial->addStorageBufferBundle(materialBufferBundle, VK_SHADER_STAGE_COMPUTE_BIT);
-        computeMaterial->addStorageBufferBundle(aabbBufferBundle, VK_SHADER_STAGE_COMPUTE_BIT);
-        computeMaterial->addStorageBufferBundle(lightsBufferBundle, VK_SHADER_STAGE_COMPUTE_BIT);
-        computeMaterial->addStorageBufferBundle(spheresBufferBundle, VK_SHADER_STAGE_COMPUTE_BIT);
-        computeModel = std::make_shared<ComputeModel>(computeMaterial);
+        computeMaterial->addStorageImage(accumulationTextures[0], VK_SHADER_STAGE_COMPUTE_BIT);
+        computeMaterial->addStorageImage(accumulationTextures[1], VK_SHADER_STAGE_COMPUTE_BIT);
+        computeMaterial->addStorageBuffer(vertexBuffer, VK_SHADER_STAGE_COMPUTE_BIT);
+        computeMaterial->addStorageBuffer(materialBuffer, VK_SHADER_STAGE_COMPUTE_BIT);
+        computeMaterial->addStorageBuffer(aabbBuffer, VK_SHADER_STAGE_COMPUTE_BIT);
+        computeMaterial->addStorageBuffer(lightsBuffer, VK_SHADER_STAGE_COMPUTE_BIT);
+        computeMaterial->addStorageBuffer(spheresBuffer, VK_SHADER_STAGE_COMPUTE_BIT);
+        computeMaterial->addStorageBufferBundle(bvhStatsBundle, VK_SHADER_STAGE_COMPUTE_BIT);
+        computeMaterial->addStorageBuffer(instancesBuffer, VK_SHADER_STAGE_COMPUTE_BIT);
+        computeMaterial->addStorageBuffer(triangleIndexBuffer, VK_SHADER_STAGE_COMPUTE_BIT);
+        computeMaterial->addStorageBuffer(triangleMaterialBuffer, VK_SHADER_STAGE_COMPUTE_BIT);
+        computeMaterial->addStorageBuffer(woopTriangleBuffer, VK_SHADER_STAGE_COMPUTE_BIT);
+        if (SHADER_COUNTERS)
+        {
+            computeMaterial->addStorageBufferBundle(pixelCostBundle, VK_SHADER_STAGE_COMPUTE_BIT);
+        }
+        computeMaterial->addSpecializationConstant(0, orderedTraversal);
+        computeMaterial->addSpecializationConstant(1, countBvhStats);
+        computeMaterial->addSpecializationConstant(2, rtScene->bvhLayout == GpuModel::BvhLayout::Roped);
+        computeMaterial->addSpecializationConstant(3, woopTriangles);
+        computeMaterial->addSpecializationConstant(4, numBounces);
+        computeMaterial->addSpecializationConstant(5, rtScene->bvhStackSize);
+        return computeMaterial;
+    }
 
-        postProcessScene = std::make_shared<Scene>(RenderPassType::eFlat);
+    // Renders one frame from the current camera with every bvh layout, with and without ordered traversal,
+    // with indexed and woop triangles, and prints the number of bvh nodes visited per ray and the frame time.
+    // Then measures the instance traversal on the scene with instances, before and after moving an instance,
+    // and the traversal of a refit bvh while the triangles of the scene move. Also prints the build times of the bvh builders.
+    void runBvhBenchmark()
+    {
+        using namespace mcvkp;
+        const GpuModel::BvhLayout sceneLayout = rtScene->bvhLayout;
+        const char *layoutNames[] = {"compact", "quantized", "wide", "roped"};
 
-        auto screenTex = std::make_shared<Texture>(targetTexture);
-        auto screenMaterial = std::make_shared<Material>(
-            path_prefix + "/shaders/generated/post-process-vert.spv",
-            path_prefix + "/shaders/generated/post-process-frag.spv");
-        screenMaterial->addTexture(screenTex, VK_SHADER_STAGE_FRAGMENT_BIT);
-        postProcessScene->addModel(std::make_shared<DrawableModel>(screenMaterial, MeshType::ePlane));
+        for (auto layout : {GpuModel::BvhLayout::Compact, GpuModel::BvhLayout::Quantized, GpuModel::BvhLayout::Wide, GpuModel::BvhLayout::Roped})
+        {
+            // Instances are only supported by the compact layout.
+            if (layout != GpuModel::BvhLayout::Compact && !rtScene->instances.empty())
+            {
+                continue;
+            }
+            rtScene->bvhLayout = layout;
+            rtScene->updateBvhLayout();
+            std::string rayTracingShader;
+            auto aabbBuffer = createBvhBuffer(rayTracingShader);
+            updateScene(0);
+
+            for (bool orderedTraversal : {false, true})
+            {
+                for (bool woopTriangles : {false, true})
+                {
+                    renderBvhBenchmarkFrame(layoutNames[int(layout)], aabbBuffer, rayTracingShader, orderedTraversal, woopTriangles);
+                }
+            }
+        }
+
+        rtScene->bvhLayout = sceneLayout;
+        rtScene->updateBvhLayout();
+
+        // The buffers of the scene are replaced while the scene with instances is measured and uploaded again after it.
+        auto benchmarkedScene = rtScene;
+        rtScene = std::make_shared<GpuModel::Scene>(true);
+        createSceneBuffers();
+        std::string rayTracingShader;
+        auto aabbBuffer = createBvhBuffer(rayTracingShader);
+        updateScene(0);
+        renderBvhBenchmarkFrame("instanced compact", aabbBuffer, rayTracingShader, true, false);
+
+        // Only the instance and the top level of the bvh change, the triangles stay on the GPU.
+        glm::mat4 transform = glm::translate(glm::mat4(1.0f), glm::vec3(0.0f, 1.0f, -1.0f));
+        rtScene->setInstanceTransform(0, glm::scale(transform, glm::vec3(0.3f)));
+        createInstancesBuffer();
+        aabbBuffer = createBvhBuffer(rayTracingShader);
+        updateScene(0);
+        renderBvhBenchmarkFrame("moved instance compact", aabbBuffer, rayTracingShader, true, false);
+
+        // The copy loads the build data, so the builders are compared on it before it moves.
+        // Moves the triangles of the copy a bit further every step. updateBvh refits the bvh until it got
+        // too slow to traverse and then rebuilds it, only a rebuild reorders the triangles.
+        rtScene = std::make_shared<GpuModel::Scene>(*benchmarkedScene);
+        rtScene->loadBuildData();
+        Bvh::compareBuilders(rtScene->bvhObjects(), rtScene->bvhOptions);
+        for (int step = 1; step <= 4; step++)
+        {
+            rtScene->moveVertices([](const glm::vec3 &v)
+                                  { return v + 0.2f * glm::vec3(std::sin(5.0f * v.y), std::sin(5.0f * v.z), std::sin(5.0f * v.x)); });
+            bool rebuilt = rtScene->updateBvh();
+            if (rebuilt)
+            {
+                createSceneBuffers();
+            }
+            else
+            {
+                vertexBuffer = createStaticBuffer(rtScene->gpuVertices.data(), rtScene->gpuVertices.size());
+            }
+            aabbBuffer = createBvhBuffer(rayTracingShader);
+            updateScene(0);
+            float costRatio = Bvh::sahCost(rtScene->bvhNodes, rtScene->bvhOptions) / rtScene->bvhBuildCost;
+            renderBvhBenchmarkFrame("moved triangles step " + std::to_string(step) + (rebuilt ? " rebuilt" : " refit") +
+                                        " SAH x" + std::to_string(costRatio) + ", " + layoutNames[int(rtScene->bvhLayout)],
+                                    aabbBuffer, rayTracingShader, true, false);
+        }
+
+        rtScene = benchmarkedScene;
+        createSceneBuffers();
+        stagingBatch->submit();
+        currentSample = 0;
+    }
+
+    // Renders one frame of the bvh benchmark with aabbBuffer and prints the statistics of the traversal under name.
+    void renderBvhBenchmarkFrame(const std::string &name,
+                                 const std::shared_ptr<mcvkp::Buffer> &aabbBuffer,
+                                 const std::string &rayTracingShader,
+                                 bool orderedTraversal,
+                                 bool woopTriangles)
+    {
+        using namespace mcvkp;
+        auto benchmarkModel = std::make_shared<ComputeModel>(createRayTracingMaterial(aabbBuffer, rayTracingShader, orderedTraversal, true, woopTriangles));
+
+        clearBvhStats(0);
+
+        // Single time commands wait for the queue to be idle, so this is the time of the whole frame on GPU
+        // plus the submission.
+        auto startTime = std::chrono::high_resolution_clock::now();
+        VkCommandBuffer commandBuffer = RenderSystem::beginSingleTimeCommands();
+        VkImageMemoryBarrier read2Gen = ImageUtils::ReadOnlyToGeneralBarrier(targetTexture->image);
+        vkCmdPipelineBarrier(commandBuffer, VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, 0, 0, nullptr, 0, nullptr, 1, &read2Gen);
+        benchmarkModel->computeCommand(commandBuffer, 0, (targetTexture->width + 31) / 32, (targetTexture->height + 31) / 32, 1);
+        VkImageMemoryBarrier gen2ReadOnly = ImageUtils::generalToReadOnlyBarrier(targetTexture->image);
+        vkCmdPipelineBarrier(commandBuffer, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT, 0, 0, nullptr, 0, nullptr, 1, &gen2ReadOnly);
+        RenderSystem::endSingleTimeCommands(commandBuffer);
+        std::chrono::duration<double, std::milli> frameTime = std::chrono::high_resolution_clock::now() - startTime;
+
+        GpuModel::BvhStats stats = readBvhStats(0);
+
+        std::cout << "Bvh benchmark: " << name << (orderedTraversal ? " ordered" : " unordered")
+                  << " traversal, " << (woopTriangles ? "woop" : "indexed") << " triangles, " << stats.raysTraced << " rays, "
+                  << double(stats.nodesVisited) / std::max(stats.raysTraced, 1u) << " nodes per ray, "
+                  << double(stats.trianglesTested) / std::max(stats.raysTraced, 1u) << " triangles per ray, "
+                  << frameTime.count() << " ms\n";
     }
 
     uint32_t currentSample = 0;
     void updateScene(uint32_t currentImage)
     {
-        float currentTime = (float)glfwGetTime();
+        // There is no glfw timer without a window.
+        float currentTime = VulkanGlobal::context.isHeadless() ? 0.0f : (float)glfwGetTime();
         if (hasMoved)
         {
             currentSample = 0;
             hasMoved = false;
         }
-        UniformBufferObject ubo = {camera.Position, currentTime, currentSample, (uint32_t)rtScene->triangles.size(), (uint32_t)rtScene->lights.size(), (uint32_t)rtScene->spheres.size()};
+        UniformBufferObject ubo = {camera.Position, currentTime, currentSample, (uint32_t)rtScene->sceneTriangleCount(), (uint32_t)rtScene->lights.size(), (uint32_t)rtScene->spheres.size(),
+                                   rtScene->quantizedBvhBox.min, rtScene->quantizedBvhBox.max};
+
+        uniformRing->write(currentImage, ubo);
+
+        currentSample++;
+    }
+
+    // Throws unless compute shaders support the subgroup operations of the shader counters build.
+    void requireSubgroupArithmetic()
+    {
+        VkPhysicalDeviceSubgroupProperties subgroupProperties{};
+        subgroupProperties.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_SUBGROUP_PROPERTIES;
+        VkPhysicalDeviceProperties2 properties{};
+        properties.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_PROPERTIES_2;
+        properties.pNext = &subgroupProperties;
+        vkGetPhysicalDeviceProperties2(VulkanGlobal::context.getPhysicalDevice(), &properties);
+
+        VkSubgroupFeatureFlags requiredOperations = VK_SUBGROUP_FEATURE_BASIC_BIT | VK_SUBGROUP_FEATURE_ARITHMETIC_BIT;
+        if (!(subgroupProperties.supportedStages & VK_SHADER_STAGE_COMPUTE_BIT) ||
+            (subgroupProperties.supportedOperations & requiredOperations) != requiredOperations)
+        {
+            throw std::runtime_error("shader counters need subgroup arithmetic in compute shaders!");
+        }
+    }
+
+    // Copies the bvh statistics of the last frame rendered with the i-th descriptor set. The frame must be done.
+    GpuModel::BvhStats readBvhStats(size_t i)
+    {
+        auto &allocation = bvhStatsBundle->buffers[i]->allocation;
+        GpuModel::BvhStats stats;
+        void *data;
+        vmaMapMemory(VulkanGlobal::context.getAllocator(), allocation, &data);
+        vmaInvalidateAllocation(VulkanGlobal::context.getAllocator(), allocation, 0, VK_WHOLE_SIZE);
+        memcpy(&stats, data, sizeof(stats));
+        vmaUnmapMemory(VulkanGlobal::context.getAllocator(), allocation);
+        return stats;
+    }
 
-        auto &allocation = computeModel->getMaterial()->getUniformBufferBundles()[0].data->buffers[currentImage]->allocation;
+    // Zeroes the bvh statistics of the i-th descriptor set before a frame that counts them.
+    void clearBvhStats(size_t i)
+    {
+        auto &allocation = bvhStatsBundle->buffers[i]->allocation;
+        GpuModel::BvhStats stats;
         void *data;
         vmaMapMemory(VulkanGlobal::context.getAllocator(), allocation, &data);
-        memcpy(data, &ubo, sizeof(ubo));
+        memcpy(data, &stats, sizeof(stats));
+        vmaFlushAllocation(VulkanGlobal::context.getAllocator(), allocation, 0, VK_WHOLE_SIZE);
         vmaUnmapMemory(VulkanGlobal::context.getAllocator(), allocation);
+    }
 
-        currentSample++;
+    void printShaderCounters()
+    {
+        const GpuModel::BvhStats &counters = lastBvhStats;
+        uint32_t paths = std::max(counters.lightTerminations + counters.missTerminations + counters.maxBounceTerminations, 1u);
+        uint32_t rays = std::max(counters.raysTraced, 1u);
+        std::cout << "Shader counters: " << counters.raysTraced << " rays, "
+                  << double(counters.nodesVisited) / rays << " nodes per ray, "
+                  << double(counters.trianglesTested) / rays << " triangles per ray, paths ended by a light "
+                  << 100.0 * counters.lightTerminations / paths << "%, by a miss "
+                  << 100.0 * counters.missTerminations / paths << "%, by the bounce limit "
+                  << 100.0 * counters.maxBounceTerminations / paths << "%\n";
+    }
+
+    // Writes the bvh nodes plus triangles tested per pixel of the last frame rendered with the i-th descriptor set as a PNG,
+    // from blue for no cost to red. The frame must be done.
+    // Costs are scaled by the 99th percentile, so a few very expensive pixels don't make the rest of the image blue.
+    void writeHeatmap(const std::string &path, size_t i)
+    {
+        auto &allocation = pixelCostBundle->buffers[i]->allocation;
+        size_t numPixels = size_t(renderExtent.width) * renderExtent.height;
+        std::vector<uint32_t> costs(numPixels);
+        void *data;
+        vmaMapMemory(VulkanGlobal::context.getAllocator(), allocation, &data);
+        vmaInvalidateAllocation(VulkanGlobal::context.getAllocator(), allocation, 0, VK_WHOLE_SIZE);
+        memcpy(costs.data(), data, numPixels * sizeof(uint32_t));
+        vmaUnmapMemory(VulkanGlobal::context.getAllocator(), allocation);
+
+        std::vector<uint32_t> sortedCosts = costs;
+        std::nth_element(sortedCosts.begin(), sortedCosts.begin() + numPixels * 99 / 100, sortedCosts.end());
+        float scale = 1.0f / std::max(sortedCosts[numPixels * 99 / 100], 1u);
+
+        std::vector<unsigned char> pixels(numPixels * 4);
+        for (size_t i = 0; i < numPixels; i++)
+        {
+            // Blue, cyan, green, yellow, red.
+            float t = std::min(costs[i] * scale, 1.0f) * 4.0f;
+            glm::vec3 color = glm::clamp(glm::vec3(t - 2.0f, t < 2.0f ? t : 4.0f - t, 2.0f - t), 0.0f, 1.0f);
+            pixels[4 * i] = static_cast<unsigned char>(color.r * 255.0f);
+            pixels[4 * i + 1] = static_cast<unsigned char>(color.g * 255.0f);
+            pixels[4 * i + 2] = static_cast<unsigned char>(color.b * 255.0f);
+            pixels[4 * i + 3] = 255;
+        }
+        std::cout << (StbImageWriteImpl::writePng(path, renderExtent.width, renderExtent.height, pixels.data()) ? "Wrote " : "Failed to write ")
+                  << path << "\n";
+    }
+
+    // Refits the bvh and makes the new boxes visible to the ray tracing shader.
+    void recordBvhRefit(VkCommandBuffer &commandBuffer, size_t i)
+    {
+        // The bvh and the counters are shared by all frames, wait for the previous frame to be done with them.
+        VkMemoryBarrier previousFrameBarrier{};
+        previousFrameBarrier.sType = VK_STRUCTURE_TYPE_MEMORY_BARRIER;
+        previousFrameBarrier.srcAccessMask = VK_ACCESS_SHADER_WRITE_BIT;
+        previousFrameBarrier.dstAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT | VK_ACCESS_SHADER_WRITE_BIT;
+        vkCmdPipelineBarrier(commandBuffer,
+                             VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT,
+                             VK_PIPELINE_STAGE_TRANSFER_BIT | VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT,
+                             0,
+                             1, &previousFrameBarrier,
+                             0, nullptr,
+                             0, nullptr);
+
+        auto &refitCounters = bvhRefitModel->getMaterial()->getStorageBufferBundles()[3].data->buffers[i];
+        vkCmdFillBuffer(commandBuffer, refitCounters->buffer, 0, VK_WHOLE_SIZE, 0);
+
+        VkMemoryBarrier clearBarrier{};
+        clearBarrier.sType = VK_STRUCTURE_TYPE_MEMORY_BARRIER;
+        clearBarrier.srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+        clearBarrier.dstAccessMask = VK_ACCESS_SHADER_READ_BIT | VK_ACCESS_SHADER_WRITE_BIT;
+        vkCmdPipelineBarrier(commandBuffer,
+                             VK_PIPELINE_STAGE_TRANSFER_BIT,
+                             VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT,
+                             0,
+                             1, &clearBarrier,
+                             0, nullptr,
+                             0, nullptr);
+
+        // One invocation per node, 64 per group.
+        bvhRefitModel->computeCommand(commandBuffer, i, (rtScene->compactBvhNodes.size() + 63) / 64, 1, 1);
+
+        VkMemoryBarrier refitBarrier{};
+        refitBarrier.sType = VK_STRUCTURE_TYPE_MEMORY_BARRIER;
+        refitBarrier.srcAccessMask = VK_ACCESS_SHADER_WRITE_BIT;
+        refitBarrier.dstAccessMask = VK_ACCESS_SHADER_READ_BIT;
+        vkCmdPipelineBarrier(commandBuffer,
+                             VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT,
+                             VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT,
+                             0,
+                             1, &refitBarrier,
+                             0, nullptr,
+                             0, nullptr);
+    }
+
+    // Records the bvh refit and the ray tracing of the i-th frame, each in a scope of profiler unless it is nullptr.
+    void recordFrame(VkCommandBuffer &commandBuffer, size_t i, const std::shared_ptr<mcvkp::ComputeModel> &model, mcvkp::GpuProfiler *profiler)
+    {
+        if (profiler)
+        {
+            profiler->beginFrame(commandBuffer, i);
+        }
+        if (bvhRefitModel)
+        {
+            if (profiler)
+            {
+                profiler->beginScope(commandBuffer, i, "bvh refit");
+            }
+            recordBvhRefit(commandBuffer, i);
+            if (profiler)
+            {
+                profiler->endScope(commandBuffer, i);
+            }
+        }
+        if (profiler)
+        {
+            profiler->beginScope(commandBuffer, i, "ray tracing");
+        }
+        recordRayTracing(commandBuffer, i, model);
+        if (profiler)
+        {
+            profiler->endScope(commandBuffer, i);
+        }
+    }
+
+    // Records the ray tracing of the i-th frame with model into the target and accumulation images.
+    void recordRayTracing(VkCommandBuffer &commandBuffer, size_t i, const std::shared_ptr<mcvkp::ComputeModel> &model)
+    {
+        auto targetImage = model->getMaterial()->getStorageImages()[0].data;
+
+        // Convert image layout to GENERAL before writing into it in compute shader.
+        VkImageMemoryBarrier read2Gen = mcvkp::ImageUtils::ReadOnlyToGeneralBarrier(targetImage->image);
+
+        vkCmdPipelineBarrier(
+            commandBuffer,
+            VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT,
+            VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT,
+            0,
+            0, nullptr,
+            0, nullptr,
+            1, &read2Gen);
+
+        // The previous frame wrote the accumulation image this one reads and read the one this one writes.
+        VkMemoryBarrier accumulationBarrier{};
+        accumulationBarrier.sType = VK_STRUCTURE_TYPE_MEMORY_BARRIER;
+        accumulationBarrier.srcAccessMask = VK_ACCESS_SHADER_WRITE_BIT;
+        accumulationBarrier.dstAccessMask = VK_ACCESS_SHADER_READ_BIT | VK_ACCESS_SHADER_WRITE_BIT;
+
+        vkCmdPipelineBarrier(
+            commandBuffer,
+            VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT,
+            VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT,
+            0,
+            1, &accumulationBarrier,
+            0, nullptr,
+            0, nullptr);
+
+        if (SHADER_COUNTERS)
+        {
+            // Counters are the totals of a single frame.
+            vkCmdFillBuffer(commandBuffer, bvhStatsBundle->buffers[i]->buffer, 0, VK_WHOLE_SIZE, 0);
+
+            VkMemoryBarrier clearBarrier{};
+            clearBarrier.sType = VK_STRUCTURE_TYPE_MEMORY_BARRIER;
+            clearBarrier.srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+            clearBarrier.dstAccessMask = VK_ACCESS_SHADER_READ_BIT | VK_ACCESS_SHADER_WRITE_BIT;
+            vkCmdPipelineBarrier(commandBuffer,
+                                 VK_PIPELINE_STAGE_TRANSFER_BIT,
+                                 VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT,
+                                 0,
+                                 1, &clearBarrier,
+                                 0, nullptr,
+                                 0, nullptr);
+        }
+
+        // Bind compute pipeline and dispatch compute command.
+        model->computeCommand(commandBuffer, i, (targetImage->width + 31) / 32, (targetImage->height + 31) / 32, 1);
+
+        // Convert image layout to READ_ONLY_OPTIMAL before reading from it in fragment shader.
+        VkImageMemoryBarrier gen2ReadOnly = mcvkp::ImageUtils::generalToReadOnlyBarrier(targetImage->image);
+
+        vkCmdPipelineBarrier(
+            commandBuffer,
+            VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT,
+            VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT,
+            0,
+            0, nullptr,
+            0, nullptr,
+            1, &gen2ReadOnly);
     }
 
     void createCommandBuffers()
     {
-        commandBuffers.resize(VulkanGlobal::swapchainContext.getImageViews().size());
+        commandBuffers.resize(VulkanGlobal::swapchainContext.getImageCount());
         VkCommandBufferAllocateInfo allocInfo{};
         allocInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_ALLOCATE_INFO;
         allocInfo.commandPool = VulkanGlobal::context.getCommandPool();
         allocInfo.level = VK_COMMAND_BUFFER_LEVEL_PRIMARY;
         allocInfo.commandBufferCount = (uint32_t)commandBuffers.size();
 
-        auto targetImage = computeModel->getMaterial()->getStorageImages()[0].data;
-        auto accumulationImage = computeModel->getMaterial()->getStorageImages()[1].data;
-
         if (vkAllocateCommandBuffers(VulkanGlobal::context.getDevice(), &allocInfo, commandBuffers.data()) != VK_SUCCESS)
         {
             throw std::runtime_error("failed to allocate command buffers!");
         }
+        gpuProfiler = std::make_shared<mcvkp::GpuProfiler>(commandBuffers.size());
 
         for (size_t i = 0; i < commandBuffers.size(); i++)
         {
@@ -212,79 +1178,12 @@ private:
                 throw std::runtime_error("failed to begin recording command buffer!");
             }
 
-            // Convert image layout to GENERAL before writing into it in compute shader.
-            VkImageMemoryBarrier read2Gen = mcvkp::ImageUtils::ReadOnlyToGeneralBarrier(targetImage->image);
-
-            vkCmdPipelineBarrier(
-                commandBuffers[i],
-                VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT,
-                VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT,
-                0,
-                0, nullptr,
-                0, nullptr,
-                1, &read2Gen);
-
-            // Bind compute pipeline and dispatch compute command.
-            computeModel->computeCommand(commandBuffers[i], i, targetImage->width / 32, targetImage->height / 32, 1);
-
-            // Transfer target and accumulation images to transfer layout and copy one into another.
-            VkImageMemoryBarrier gen2TranSrc = mcvkp::ImageUtils::generalToTransferSrcBarrier(targetImage->image);
-
-            vkCmdPipelineBarrier(
-                commandBuffers[i],
-                VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT,
-                VK_PIPELINE_STAGE_TRANSFER_BIT,
-                0,
-                0, nullptr,
-                0, nullptr,
-                1, &gen2TranSrc);
-
-            VkImageMemoryBarrier gen2TranDst = mcvkp::ImageUtils::generalToTransferDstBarrier(accumulationImage->image);
-
-            vkCmdPipelineBarrier(
-                commandBuffers[i],
-                VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT,
-                VK_PIPELINE_STAGE_TRANSFER_BIT,
-                0,
-                0, nullptr,
-                0, nullptr,
-                1, &gen2TranDst);
-
-            VkImageCopy region = mcvkp::ImageUtils::imageCopyRegion(targetImage->width, targetImage->height);
-            vkCmdCopyImage(
-                commandBuffers[i],
-                targetImage->image,
-                VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL,
-                accumulationImage->image,
-                VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL,
-                1,
-                &region);
-
-            VkImageMemoryBarrier tranDst2Gen = mcvkp::ImageUtils::transferDstToGeneralBarrier(accumulationImage->image);
-
-            vkCmdPipelineBarrier(
-                commandBuffers[i],
-                VK_PIPELINE_STAGE_TRANSFER_BIT,
-                VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT,
-                0,
-                0, nullptr,
-                0, nullptr,
-                1, &tranDst2Gen);
-
-            // Convert image layout to READ_ONLY_OPTIMAL before reading from it in fragment shader.
-            VkImageMemoryBarrier tranSrc2ReadOnly = mcvkp::ImageUtils::transferSrcToReadOnlyBarrier(targetImage->image);
-
-            vkCmdPipelineBarrier(
-                commandBuffers[i],
-                VK_PIPELINE_STAGE_TRANSFER_BIT,
-                VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT,
-                0,
-                0, nullptr,
-                0, nullptr,
-                1, &tranSrc2ReadOnly);
+            recordFrame(commandBuffers[i], i, computeModel, gpuProfiler.get());
 
             // Bind graphics pipeline and dispatch draw command.
+            gpuProfiler->beginScope(commandBuffers[i], i, "post process");
             postProcessScene->writeRenderCommand(commandBuffers[i], i);
+            gpuProfiler->endScope(commandBuffers[i], i);
 
             if (vkEndCommandBuffer(commandBuffers[i]) != VK_SUCCESS)
             {
@@ -298,7 +1197,7 @@ private:
         imageAvailableSemaphores.resize(MAX_FRAMES_IN_FLIGHT);
         renderFinishedSemaphores.resize(MAX_FRAMES_IN_FLIGHT);
         inFlightFences.resize(MAX_FRAMES_IN_FLIGHT);
-        imagesInFlight.resize(VulkanGlobal::swapchainContext.getImageViews().size());
+        imagesInFlight.resize(VulkanGlobal::swapchainContext.getImageCount());
 
         VkSemaphoreCreateInfo semaphoreInfo{};
         semaphoreInfo.sType = VK_STRUCTURE_TYPE_SEMAPHORE_CREATE_INFO;
@@ -320,6 +1219,8 @@ private:
     }
 
     size_t currentFrame = 0;
+    // Swapchain image of the last submitted frame, read back by the shader counters on exit.
+    uint32_t lastSubmittedImage = 0;
     void drawFrame()
     {
         vkWaitForFences(VulkanGlobal::context.getDevice(), 1, &inFlightFences[currentFrame], VK_TRUE, UINT64_MAX);
@@ -345,6 +1246,12 @@ private:
         if (imagesInFlight[imageIndex] != VK_NULL_HANDLE)
         {
             vkWaitForFences(VulkanGlobal::context.getDevice(), 1, &imagesInFlight[imageIndex], VK_TRUE, UINT64_MAX);
+            // The previous submission of this image is done, its timestamps are read without waiting.
+            gpuProfiler->collect(imageIndex);
+            if (SHADER_COUNTERS)
+            {
+                lastBvhStats = readBvhStats(imageIndex);
+            }
         }
         // Mark the image as now being in use by this frame
         imagesInFlight[imageIndex] = inFlightFences[currentFrame];
@@ -371,6 +1278,7 @@ private:
         {
             throw std::runtime_error("failed to submit draw command buffer!");
         }
+        lastSubmittedImage = imageIndex;
         VkPresentInfoKHR presentInfo{};
         presentInfo.sType = VK_STRUCTURE_TYPE_PRESENT_INFO_KHR;
 
@@ -407,6 +1315,11 @@ private:
             { // If last prinf() was more than 1 sec ago
                 // printf and reset timer
                 printf("%f ms/frame\n", 1000.0 / double(nbFrames));
+                gpuProfiler->print(std::cout);
+                if (SHADER_COUNTERS)
+                {
+                    printShaderCounters();
+                }
                 nbFrames = 0;
                 lastTime = currentTime;
             }
@@ -423,6 +1336,14 @@ private:
     void initVulkan()
     {
         initScene();
+        if (BVH_BENCHMARK)
+        {
+            runBvhBenchmark();
+        }
+        stagingRing.reset();
+        stagingBatch.reset();
+        // Everything is uploaded, the GPU triangles are only needed again if the scene changes.
+        rtScene->releaseGpuTriangles();
 
         createCommandBuffers();
         createSyncObjects();
@@ -438,17 +1359,44 @@ private:
             vkDestroyFence(VulkanGlobal::context.getDevice(), inFlightFences[i], nullptr);
         }
 
+        if (WRITE_GPU_TRACE)
+        {
+            std::cout << (gpuProfiler->writeChromeTrace(GPU_TRACE_PATH) ? "Wrote " : "Failed to write ") << GPU_TRACE_PATH << "\n";
+        }
+        if (SHADER_COUNTERS)
+        {
+            // mainLoop waited for the device to be idle, so the last submitted frame is done.
+            lastBvhStats = readBvhStats(lastSubmittedImage);
+            printShaderCounters();
+            writeHeatmap(HEATMAP_PATH, lastSubmittedImage);
+        }
+
         glfwTerminate();
     }
 };
 
-int main()
+int main(int argc, char **argv)
 {
     HelloComputeApplication app;
 
     try
     {
+#if defined(GPU_BENCHMARK)
+        app.runGpuBenchmark(parseBenchmarkOptions(argc, argv));
+#elif defined(HEADLESS_RENDER)
+        // headless-render [width] [height] [samples] [output.png|output.hdr]
+        uint32_t width = argc > 1 ? std::stoul(argv[1]) : WIDTH;
+        uint32_t height = argc > 2 ? std::stoul(argv[2]) : HEIGHT;
+        uint32_t samples = argc > 3 ? std::stoul(argv[3]) : 64;
+        std::string outputPath = argc > 4 ? argv[4] : "render.png";
+        if (width == 0 || height == 0 || samples == 0)
+        {
+            throw std::runtime_error("width, height and samples must be positive!");
+        }
+        app.renderOffscreen(width, height, samples, outputPath);
+#else
         app.run();
+#endif
     }
     catch (const std::exception &e)
     {
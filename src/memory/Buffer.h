@@ -17,9 +17,17 @@ namespace mcvkp
         VkBuffer buffer;
         VmaAllocation allocation;
         VkDeviceSize size;
+        // Start of the data in buffer, only set for ranges of a BufferPool arena.
+        VkDeviceSize offset = 0;
+        // Set for ranges of a BufferPool arena, the arena owns buffer and allocation.
+        std::shared_ptr<Buffer> arena;
 
         ~Buffer()
         {
+            if (arena)
+            {
+                return;
+            }
             std::cout << "Destroying buffer"
                       << "\n";
             if (buffer != VK_NULL_HANDLE)
@@ -33,7 +41,7 @@ namespace mcvkp
         {
             VkDescriptorBufferInfo descriptorInfo{};
             descriptorInfo.buffer = buffer;
-            descriptorInfo.offset = 0;
+            descriptorInfo.offset = offset;
             descriptorInfo.range = size;
             return descriptorInfo;
         }
@@ -50,6 +58,11 @@ namespace mcvkp
                 buffers.push_back(std::make_shared<Buffer>());
             }
         }
+
+        // Bundle where every descriptor set binds the same buffer, for data that doesn't change between frames.
+        BufferBundle(size_t numBuffers, const std::shared_ptr<Buffer> &sharedBuffer) : buffers(numBuffers, sharedBuffer)
+        {
+        }
     };
 
     namespace BufferUtils
@@ -82,7 +95,7 @@ namespace mcvkp
         template <typename T>
         void inline create(Buffer *buffer, const T *elements, const size_t numElements, VkBufferUsageFlags usage, VmaMemoryUsage memoryUsage)
         {
-            buffer->size = sizeof(T);
+            buffer->size = numElements * sizeof(T);
 
             allocate(buffer, numElements * sizeof(T), usage, memoryUsage);
 
@@ -107,4 +120,179 @@ namespace mcvkp
             createBundle(bufferBundle, &element, 1, usage, memoryUsage);
         }
     };
+
+    /*
+     * Uniform buffer split into one region per frame, mapped for its whole lifetime.
+     * A single dynamic uniform buffer descriptor covers one region and the region of a frame is selected
+     * by its dynamic offset when binding the descriptor set, so updating a frame is a plain write into mapped memory.
+     * Per-frame data can grow up to the region size without adding descriptor bindings.
+     */
+    class UniformRing
+    {
+    public:
+        UniformRing(uint32_t numFrames, VkDeviceSize frameSize = 16 << 10) : m_numFrames(numFrames), m_frameSize(frameSize)
+        {
+            VkPhysicalDeviceProperties properties;
+            vkGetPhysicalDeviceProperties(VulkanGlobal::context.getPhysicalDevice(), &properties);
+            if (frameSize > properties.limits.maxUniformBufferRange)
+            {
+                throw std::runtime_error("uniform ring frame is larger than maxUniformBufferRange!");
+            }
+            VkDeviceSize alignment = properties.limits.minUniformBufferOffsetAlignment;
+            m_frameStride = (frameSize + alignment - 1) / alignment * alignment;
+
+            VkBufferCreateInfo bufferInfo{};
+            bufferInfo.sType = VK_STRUCTURE_TYPE_BUFFER_CREATE_INFO;
+            bufferInfo.size = m_frameStride * numFrames;
+            bufferInfo.usage = VK_BUFFER_USAGE_UNIFORM_BUFFER_BIT;
+            bufferInfo.sharingMode = VK_SHARING_MODE_EXCLUSIVE;
+
+            // Coherent, so writes don't have to be flushed.
+            VmaAllocationCreateInfo vmaallocInfo = {};
+            vmaallocInfo.usage = VMA_MEMORY_USAGE_CPU_TO_GPU;
+            vmaallocInfo.requiredFlags = VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT;
+            vmaallocInfo.flags = VMA_ALLOCATION_CREATE_MAPPED_BIT;
+
+            m_buffer = std::make_shared<Buffer>();
+            m_buffer->size = bufferInfo.size;
+            VmaAllocationInfo allocationInfo;
+            if (vmaCreateBuffer(VulkanGlobal::context.getAllocator(),
+                                &bufferInfo,
+                                &vmaallocInfo,
+                                &m_buffer->buffer,
+                                &m_buffer->allocation,
+                                &allocationInfo) != VK_SUCCESS)
+            {
+                throw std::runtime_error("failed to create uniform ring buffer");
+            }
+            m_mapped = static_cast<char *>(allocationInfo.pMappedData);
+        }
+
+        UniformRing(const UniformRing &) = delete;
+        UniformRing &operator=(const UniformRing &) = delete;
+
+        // Writes value at offset into the region of frame. The GPU has to be done with the previous use of the frame.
+        template <typename T>
+        void write(uint32_t frame, const T &value, VkDeviceSize offset = 0)
+        {
+            if (frame >= m_numFrames || offset + sizeof(T) > m_frameSize)
+            {
+                throw std::runtime_error("uniform ring write out of range!");
+            }
+            memcpy(m_mapped + frame * m_frameStride + offset, &value, sizeof(T));
+        }
+
+        uint32_t getDynamicOffset(size_t frame) const
+        {
+            return static_cast<uint32_t>(frame * m_frameStride);
+        }
+
+        // Covers one frame, the dynamic offset moves it to the region of the bound frame.
+        VkDescriptorBufferInfo getDescriptorInfo() const
+        {
+            VkDescriptorBufferInfo descriptorInfo{};
+            descriptorInfo.buffer = m_buffer->buffer;
+            descriptorInfo.offset = 0;
+            descriptorInfo.range = m_frameSize;
+            return descriptorInfo;
+        }
+
+    private:
+        uint32_t m_numFrames;
+        VkDeviceSize m_frameSize;
+        VkDeviceSize m_frameStride;
+        // Unmapped by VMA when the buffer is destroyed.
+        char *m_mapped = nullptr;
+        std::shared_ptr<Buffer> m_buffer;
+    };
+
+    /*
+     * Uploads to device local buffers, recorded into one command buffer and submitted together.
+     * Every upload has its own staging buffer, so this is meant for many small buffers, see StagingRing for big ones.
+     */
+    class StagingBatch
+    {
+    public:
+        StagingBatch() = default;
+
+        ~StagingBatch()
+        {
+            submit();
+        }
+
+        StagingBatch(const StagingBatch &) = delete;
+        StagingBatch &operator=(const StagingBatch &) = delete;
+
+        // Records a copy of size bytes from data to dst at dstOffset. data can be freed right away, dst is only written by submit.
+        void upload(VkBuffer dst, VkDeviceSize dstOffset, const void *data, VkDeviceSize size)
+        {
+            if (m_commandBuffer == VK_NULL_HANDLE)
+            {
+                VkCommandBufferAllocateInfo allocInfo{};
+                allocInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_ALLOCATE_INFO;
+                allocInfo.level = VK_COMMAND_BUFFER_LEVEL_PRIMARY;
+                allocInfo.commandPool = VulkanGlobal::context.getCommandPool();
+                allocInfo.commandBufferCount = 1;
+                vkAllocateCommandBuffers(VulkanGlobal::context.getDevice(), &allocInfo, &m_commandBuffer);
+
+                VkCommandBufferBeginInfo beginInfo{};
+                beginInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO;
+                beginInfo.flags = VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT;
+                vkBeginCommandBuffer(m_commandBuffer, &beginInfo);
+            }
+
+            auto staging = std::make_shared<Buffer>();
+            BufferUtils::create(staging.get(), static_cast<const char *>(data), size, VK_BUFFER_USAGE_TRANSFER_SRC_BIT, VMA_MEMORY_USAGE_CPU_ONLY);
+            m_stagingBuffers.push_back(staging);
+
+            VkBufferCopy region{0, dstOffset, size};
+            vkCmdCopyBuffer(m_commandBuffer, staging->buffer, dst, 1, &region);
+        }
+
+        // Submits all copies recorded since the last submit and waits for them. The batch can be reused afterwards.
+        void submit()
+        {
+            if (m_commandBuffer == VK_NULL_HANDLE)
+            {
+                return;
+            }
+
+            // Make the copies visible to the shaders of all later submissions.
+            VkMemoryBarrier barrier{};
+            barrier.sType = VK_STRUCTURE_TYPE_MEMORY_BARRIER;
+            barrier.srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+            barrier.dstAccessMask = VK_ACCESS_SHADER_READ_BIT | VK_ACCESS_SHADER_WRITE_BIT;
+            vkCmdPipelineBarrier(m_commandBuffer, VK_PIPELINE_STAGE_TRANSFER_BIT,
+                                 VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT | VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT,
+                                 0, 1, &barrier, 0, nullptr, 0, nullptr);
+            vkEndCommandBuffer(m_commandBuffer);
+
+            VkSubmitInfo submitInfo{};
+            submitInfo.sType = VK_STRUCTURE_TYPE_SUBMIT_INFO;
+            submitInfo.commandBufferCount = 1;
+            submitInfo.pCommandBuffers = &m_commandBuffer;
+            vkQueueSubmit(VulkanGlobal::context.getGraphicsQueue(), 1, &submitInfo, VK_NULL_HANDLE);
+            vkQueueWaitIdle(VulkanGlobal::context.getGraphicsQueue());
+
+            vkFreeCommandBuffers(VulkanGlobal::context.getDevice(), VulkanGlobal::context.getCommandPool(), 1, &m_commandBuffer);
+            m_commandBuffer = VK_NULL_HANDLE;
+            m_stagingBuffers.clear();
+        }
+
+    private:
+        VkCommandBuffer m_commandBuffer = VK_NULL_HANDLE;
+        std::vector<std::shared_ptr<Buffer>> m_stagingBuffers;
+    };
+
+    namespace BufferUtils
+    {
+        // Creates a device local buffer, filled when the batch is submitted.
+        template <typename T>
+        void inline createDeviceLocal(Buffer *buffer, const T *elements, const size_t numElements, VkBufferUsageFlags usage, StagingBatch &stagingBatch)
+        {
+            buffer->size = numElements * sizeof(T);
+            allocate(buffer, buffer->size, usage | VK_BUFFER_USAGE_TRANSFER_DST_BIT, VMA_MEMORY_USAGE_GPU_ONLY);
+            stagingBatch.upload(buffer->buffer, 0, elements, buffer->size);
+        }
+    }
 }
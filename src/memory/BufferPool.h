@@ -0,0 +1,100 @@
+#pragma once
+
+#include "../utils/vulkan.h"
+#include "vk_mem_alloc.h"
+#include <vector>
+#include <memory>
+#include <algorithm>
+#include "Buffer.h"
+
+namespace mcvkp
+{
+    /*
+     * Linear sub-allocator carving small buffers out of a few large arenas, so the number of VMA allocations
+     * stays flat no matter how many meshes, instances or parameter blocks a scene has.
+     * A range is a Buffer holding the arena buffer and its offset in it. Bound as a descriptor, the offset
+     * is applied by the descriptor, a shader binding the whole arena can address the range by its offset.
+     * Ranges are never freed one by one, arenas are released when the pool and all its ranges are gone.
+     */
+    class BufferPool
+    {
+    public:
+        BufferPool(VkBufferUsageFlags usage, VmaMemoryUsage memoryUsage, VkDeviceSize arenaSize = 16 << 20)
+            : m_usage(usage), m_memoryUsage(memoryUsage), m_arenaSize(arenaSize)
+        {
+            VkPhysicalDeviceProperties properties;
+            vkGetPhysicalDeviceProperties(VulkanGlobal::context.getPhysicalDevice(), &properties);
+            // Enough for std430 arrays of vec4, raised to what descriptor offsets need.
+            m_alignment = 16;
+            if (usage & VK_BUFFER_USAGE_STORAGE_BUFFER_BIT)
+            {
+                m_alignment = std::max(m_alignment, properties.limits.minStorageBufferOffsetAlignment);
+            }
+            if (usage & VK_BUFFER_USAGE_UNIFORM_BUFFER_BIT)
+            {
+                m_alignment = std::max(m_alignment, properties.limits.minUniformBufferOffsetAlignment);
+            }
+        }
+
+        BufferPool(const BufferPool &) = delete;
+        BufferPool &operator=(const BufferPool &) = delete;
+
+        // Returns an aligned range of size bytes. Ranges bigger than the arena size get an arena of their own.
+        std::shared_ptr<Buffer> allocate(VkDeviceSize size)
+        {
+            if (size == 0)
+            {
+                throw std::runtime_error("can't allocate an empty buffer range!");
+            }
+            VkDeviceSize offset = (m_offset + m_alignment - 1) / m_alignment * m_alignment;
+            if (m_arenas.empty() || offset + size > m_arenas.back()->size)
+            {
+                auto arena = std::make_shared<Buffer>();
+                arena->size = std::max(m_arenaSize, size);
+                BufferUtils::allocate(arena.get(), arena->size, m_usage, m_memoryUsage);
+                m_arenas.push_back(arena);
+                offset = 0;
+            }
+            m_offset = offset + size;
+            m_numRanges++;
+
+            auto range = std::make_shared<Buffer>();
+            range->arena = m_arenas.back();
+            range->buffer = range->arena->buffer;
+            range->allocation = range->arena->allocation;
+            range->offset = offset;
+            range->size = size;
+            return range;
+        }
+
+        // Allocates a range and fills it with elements when the batch is submitted. Needs a pool created with
+        // VK_BUFFER_USAGE_TRANSFER_DST_BIT.
+        template <typename T>
+        std::shared_ptr<Buffer> create(const T *elements, size_t numElements, StagingBatch &stagingBatch)
+        {
+            auto range = allocate(numElements * sizeof(T));
+            stagingBatch.upload(range->buffer, range->offset, elements, range->size);
+            return range;
+        }
+
+        size_t getArenaCount() const
+        {
+            return m_arenas.size();
+        }
+
+        size_t getRangeCount() const
+        {
+            return m_numRanges;
+        }
+
+    private:
+        VkBufferUsageFlags m_usage;
+        VmaMemoryUsage m_memoryUsage;
+        VkDeviceSize m_arenaSize;
+        VkDeviceSize m_alignment;
+        std::vector<std::shared_ptr<Buffer>> m_arenas;
+        // End of the last range in the last arena.
+        VkDeviceSize m_offset = 0;
+        size_t m_numRanges = 0;
+    };
+}
@@ -209,6 +209,62 @@ namespace mcvkp
             RenderSystem::endSingleTimeCommands(commandBuffer);
         }
 
+        void copyImageToBuffer(VkImage image, VkImageLayout imageLayout, const VkBuffer &buffer, uint32_t width, uint32_t height)
+        {
+            VkCommandBuffer commandBuffer = RenderSystem::beginSingleTimeCommands();
+
+            VkMemoryBarrier shaderWriteBarrier{};
+            shaderWriteBarrier.sType = VK_STRUCTURE_TYPE_MEMORY_BARRIER;
+            shaderWriteBarrier.srcAccessMask = VK_ACCESS_SHADER_WRITE_BIT;
+            shaderWriteBarrier.dstAccessMask = VK_ACCESS_TRANSFER_READ_BIT;
+            vkCmdPipelineBarrier(commandBuffer,
+                                 VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT,
+                                 VK_PIPELINE_STAGE_TRANSFER_BIT,
+                                 0,
+                                 1, &shaderWriteBarrier,
+                                 0, nullptr,
+                                 0, nullptr);
+
+            VkBufferImageCopy region{};
+            region.bufferOffset = 0;
+            region.bufferRowLength = 0;
+            region.bufferImageHeight = 0;
+
+            region.imageSubresource.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
+            region.imageSubresource.mipLevel = 0;
+            region.imageSubresource.baseArrayLayer = 0;
+            region.imageSubresource.layerCount = 1;
+
+            region.imageOffset = {0, 0, 0};
+            region.imageExtent = {
+                width,
+                height,
+                1};
+
+            vkCmdCopyImageToBuffer(
+                commandBuffer,
+                image,
+                imageLayout,
+                buffer,
+                1,
+                &region);
+
+            // Make the copy visible to the host.
+            VkMemoryBarrier hostReadBarrier{};
+            hostReadBarrier.sType = VK_STRUCTURE_TYPE_MEMORY_BARRIER;
+            hostReadBarrier.srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+            hostReadBarrier.dstAccessMask = VK_ACCESS_HOST_READ_BIT;
+            vkCmdPipelineBarrier(commandBuffer,
+                                 VK_PIPELINE_STAGE_TRANSFER_BIT,
+                                 VK_PIPELINE_STAGE_HOST_BIT,
+                                 0,
+                                 1, &hostReadBarrier,
+                                 0, nullptr,
+                                 0, nullptr);
+
+            RenderSystem::endSingleTimeCommands(commandBuffer);
+        }
+
         void generateMipmaps(VkImage image,
                              VkFormat imageFormat,
                              int32_t texWidth,
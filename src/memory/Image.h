@@ -48,6 +48,9 @@ namespace mcvkp
 
         void copyBufferToImage(const VkBuffer &buffer, VkImage image, uint32_t width, uint32_t height);
 
+        // Copies an image written by shaders into a buffer, for reading it back on CPU.
+        void copyImageToBuffer(VkImage image, VkImageLayout imageLayout, const VkBuffer &buffer, uint32_t width, uint32_t height);
+
         void generateMipmaps(VkImage image,
                              VkFormat imageFormat,
                              int32_t texWidth,
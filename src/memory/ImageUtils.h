@@ -57,6 +57,19 @@ namespace mcvkp
             return memoryBarrier;
         }
 
+        VkImageMemoryBarrier generalToReadOnlyBarrier(const VkImage &image)
+        {
+            VkImageMemoryBarrier memoryBarrier = {};
+            memoryBarrier.sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER;
+            memoryBarrier.oldLayout = VK_IMAGE_LAYOUT_GENERAL;
+            memoryBarrier.newLayout = VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL;
+            memoryBarrier.image = image;
+            memoryBarrier.subresourceRange = {VK_IMAGE_ASPECT_COLOR_BIT, 0, 1, 0, 1};
+            memoryBarrier.srcAccessMask = VK_ACCESS_SHADER_WRITE_BIT;
+            memoryBarrier.dstAccessMask = VK_ACCESS_SHADER_READ_BIT;
+            return memoryBarrier;
+        }
+
         VkImageMemoryBarrier transferSrcToReadOnlyBarrier(const VkImage &image)
         {
             VkImageMemoryBarrier memoryBarrier = {};
@@ -0,0 +1,156 @@
+#pragma once
+
+#include "../utils/vulkan.h"
+#include "vk_mem_alloc.h"
+#include <vector>
+#include <memory>
+#include <cstring>
+#include <algorithm>
+#include "Buffer.h"
+
+namespace mcvkp
+{
+    /*
+     * Fixed size host visible buffer split into slots, through which data of any size is streamed into device local buffers.
+     * Every slot is copied by its own submission, so filling the next slot overlaps with the GPU copying the previous ones.
+     * When the source is a memory mapped file, reading it from disk happens while filling a slot and overlaps too.
+     * The scene cache is such a source on every platform, see SceneCache::mapFile.
+     * Host memory used for staging stays at the size of the ring, no matter how much data is uploaded.
+     */
+    class StagingRing
+    {
+    public:
+        StagingRing(VkDeviceSize slotSize = 4 << 20, uint32_t numSlots = 4) : m_slotSize(slotSize), m_slots(numSlots)
+        {
+            m_staging = std::make_shared<Buffer>();
+            m_staging->size = slotSize * numSlots;
+            BufferUtils::allocate(m_staging.get(), m_staging->size, VK_BUFFER_USAGE_TRANSFER_SRC_BIT, VMA_MEMORY_USAGE_CPU_ONLY);
+            // Mapped for the whole lifetime of the ring.
+            vmaMapMemory(VulkanGlobal::context.getAllocator(), m_staging->allocation, &m_mapped);
+
+            VkFenceCreateInfo fenceInfo{};
+            fenceInfo.sType = VK_STRUCTURE_TYPE_FENCE_CREATE_INFO;
+            for (auto &slot : m_slots)
+            {
+                if (vkCreateFence(VulkanGlobal::context.getDevice(), &fenceInfo, nullptr, &slot.fence) != VK_SUCCESS)
+                {
+                    throw std::runtime_error("failed to create staging fence!");
+                }
+            }
+        }
+
+        ~StagingRing()
+        {
+            flush();
+            for (auto &slot : m_slots)
+            {
+                vkDestroyFence(VulkanGlobal::context.getDevice(), slot.fence, nullptr);
+            }
+            vmaUnmapMemory(VulkanGlobal::context.getAllocator(), m_staging->allocation);
+        }
+
+        StagingRing(const StagingRing &) = delete;
+        StagingRing &operator=(const StagingRing &) = delete;
+
+        // Copies size bytes from data into dst at dstOffset. Returns once the last slot is submitted,
+        // the copies are visible to compute and fragment shaders submitted later. data can be freed right away.
+        void upload(VkBuffer dst, VkDeviceSize dstOffset, const void *data, VkDeviceSize size)
+        {
+            const char *bytes = static_cast<const char *>(data);
+            for (VkDeviceSize offset = 0; offset < size; offset += m_slotSize)
+            {
+                VkDeviceSize chunkSize = std::min(m_slotSize, size - offset);
+                uint32_t slotIndex = m_nextSlot;
+                m_nextSlot = (m_nextSlot + 1) % m_slots.size();
+
+                Slot &slot = m_slots[slotIndex];
+                wait(slot);
+
+                VkDeviceSize stagingOffset = slotIndex * m_slotSize;
+                memcpy(static_cast<char *>(m_mapped) + stagingOffset, bytes + offset, chunkSize);
+                vmaFlushAllocation(VulkanGlobal::context.getAllocator(), m_staging->allocation, stagingOffset, chunkSize);
+
+                VkCommandBufferAllocateInfo allocInfo{};
+                allocInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_ALLOCATE_INFO;
+                allocInfo.level = VK_COMMAND_BUFFER_LEVEL_PRIMARY;
+                allocInfo.commandPool = VulkanGlobal::context.getCommandPool();
+                allocInfo.commandBufferCount = 1;
+                vkAllocateCommandBuffers(VulkanGlobal::context.getDevice(), &allocInfo, &slot.commandBuffer);
+
+                VkCommandBufferBeginInfo beginInfo{};
+                beginInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO;
+                beginInfo.flags = VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT;
+                vkBeginCommandBuffer(slot.commandBuffer, &beginInfo);
+
+                VkBufferCopy region{stagingOffset, dstOffset + offset, chunkSize};
+                vkCmdCopyBuffer(slot.commandBuffer, m_staging->buffer, dst, 1, &region);
+
+                // Make the copy visible to the shaders of all later submissions.
+                VkMemoryBarrier barrier{};
+                barrier.sType = VK_STRUCTURE_TYPE_MEMORY_BARRIER;
+                barrier.srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+                barrier.dstAccessMask = VK_ACCESS_SHADER_READ_BIT | VK_ACCESS_SHADER_WRITE_BIT;
+                vkCmdPipelineBarrier(slot.commandBuffer, VK_PIPELINE_STAGE_TRANSFER_BIT,
+                                     VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT | VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT,
+                                     0, 1, &barrier, 0, nullptr, 0, nullptr);
+                vkEndCommandBuffer(slot.commandBuffer);
+
+                VkSubmitInfo submitInfo{};
+                submitInfo.sType = VK_STRUCTURE_TYPE_SUBMIT_INFO;
+                submitInfo.commandBufferCount = 1;
+                submitInfo.pCommandBuffers = &slot.commandBuffer;
+                if (vkQueueSubmit(VulkanGlobal::context.getGraphicsQueue(), 1, &submitInfo, slot.fence) != VK_SUCCESS)
+                {
+                    throw std::runtime_error("failed to submit staging copy!");
+                }
+            }
+        }
+
+        // Waits for all submitted copies.
+        void flush()
+        {
+            for (auto &slot : m_slots)
+            {
+                wait(slot);
+            }
+        }
+
+    private:
+        struct Slot
+        {
+            // Only set while a copy from this slot is in flight.
+            VkCommandBuffer commandBuffer = VK_NULL_HANDLE;
+            VkFence fence = VK_NULL_HANDLE;
+        };
+
+        void wait(Slot &slot)
+        {
+            if (slot.commandBuffer == VK_NULL_HANDLE)
+            {
+                return;
+            }
+            vkWaitForFences(VulkanGlobal::context.getDevice(), 1, &slot.fence, VK_TRUE, UINT64_MAX);
+            vkResetFences(VulkanGlobal::context.getDevice(), 1, &slot.fence);
+            vkFreeCommandBuffers(VulkanGlobal::context.getDevice(), VulkanGlobal::context.getCommandPool(), 1, &slot.commandBuffer);
+            slot.commandBuffer = VK_NULL_HANDLE;
+        }
+
+        VkDeviceSize m_slotSize;
+        std::vector<Slot> m_slots;
+        uint32_t m_nextSlot = 0;
+        std::shared_ptr<Buffer> m_staging;
+        void *m_mapped = nullptr;
+    };
+
+    namespace BufferUtils
+    {
+        // Creates a device local buffer and streams elements into it through the staging ring.
+        template <typename T>
+        void inline createDeviceLocal(Buffer *buffer, const T *elements, const size_t numElements, VkBufferUsageFlags usage, StagingRing &stagingRing)
+        {
+            buffer->size = numElements * sizeof(T);
+            allocate(buffer, buffer->size, usage | VK_BUFFER_USAGE_TRANSFER_DST_BIT, VMA_MEMORY_USAGE_GPU_ONLY);
+            stagingRing.upload(buffer->buffer, 0, elements, buffer->size);
+        }
+    }
+}
@@ -4,6 +4,12 @@
 #include <stack>
 #include <stdlib.h> /* srand, rand */
 #include <algorithm>
+#include <numeric>
+#include <cfloat>
+#include <atomic>
+#include <thread>
+#include <chrono>
+#include <iostream>
 #include "../utils/glm.h"
 #include "GpuModels.h"
 
@@ -21,7 +27,7 @@ namespace Bvh
         alignas(16) glm::vec3 min = {FLT_MAX, FLT_MAX, FLT_MAX};
         alignas(16) glm::vec3 max = {-FLT_MAX, -FLT_MAX, -FLT_MAX};
 
-        int longestAxis()
+        int longestAxis() const
         {
             float x = abs(max[0] - min[0]);
             float y = abs(max[1] - min[1]);
@@ -43,13 +49,65 @@ namespace Bvh
         {
             return rand() % 3;
         }
+
+        float surfaceArea() const
+        {
+            glm::vec3 d = max - min;
+            return 2.0f * (d.x * d.y + d.y * d.z + d.z * d.x);
+        }
+
+        glm::vec3 centroid() const
+        {
+            return 0.5f * (min + max);
+        }
+
+        void grow(const Aabb &box)
+        {
+            min = glm::min(min, box.min);
+            max = glm::max(max, box.max);
+        }
+
+        void grow(const glm::vec3 &p)
+        {
+            min = glm::min(min, p);
+            max = glm::max(max, p);
+        }
     };
 
-    // Utility structure to keep track of the initial triangle index in the triangles array while sorting.
+    enum class BuilderType
+    {
+        // Random axis, split at the object median.
+        RandomMedian,
+        // Binned surface area heuristic.
+        BinnedSah,
+        // Linear bvh, objects sorted along a Morton curve. Fast to build, lower quality than SAH.
+        Lbvh
+    };
+
+    // Parameters of the bvh build.
+    struct BuildOptions
+    {
+        BuilderType builder = BuilderType::BinnedSah;
+        // Number of bins per axis in which SAH split candidates are evaluated.
+        int sahBins = 16;
+        // SAH cost model: cost of visiting an inner node and of intersecting one primitive.
+        float traversalCost = 1.0f;
+        float intersectionCost = 1.0f;
+        // Maximum number of objects in a leaf. Bigger leaves mean less nodes but more intersection tests per leaf.
+        int maxLeafSize = 4;
+        // Threads used by the SAH builder, 0 uses all hardware threads and 1 builds on the calling thread.
+        unsigned buildThreads = 0;
+    };
+
+    // Utility structure to keep track of the initial primitive index in the triangles or spheres array while sorting.
     struct Object0
     {
         uint32_t index;
         GpuModel::Triangle t;
+        // Spheres are stored in s instead of t, instances only have their world box.
+        GpuModel::PrimitiveType type = GpuModel::TrianglePrimitive;
+        GpuModel::Sphere s;
+        Aabb box;
     };
 
     // Intermediate BvhNode structure needed for constructing Bvh.
@@ -60,6 +118,8 @@ namespace Bvh
         int index = -1;
         int leftNodeIndex = -1;
         int rightNodeIndex = -1;
+        // Position of the first object of a leaf in the reordered object array.
+        int firstObjectIndex = -1;
         std::vector<Object0> objects;
 
         GpuModel::BvhNode getGpuModel()
@@ -74,7 +134,8 @@ namespace Bvh
 
             if (leaf)
             {
-                node.objectIndex = objects[0].index;
+                node.objectIndex = firstObjectIndex;
+                node.objectCount = objects.size();
             }
 
             return node;
@@ -91,12 +152,60 @@ namespace Bvh
         return {glm::min(box0.min, box1.min), glm::max(box0.max, box1.max)};
     }
 
-    Aabb objectBoundingBox(GpuModel::Triangle &t)
+    Aabb objectBoundingBox(const GpuModel::Triangle &t)
     {
         // Need to add eps to correctly construct an AABB for flat objects like planes.
         return {glm::min(glm::min(t.v0, t.v1), t.v2) - eps, glm::max(glm::max(t.v0, t.v1), t.v2) + eps};
     }
 
+    inline Aabb objectBoundingBox(const GpuModel::Sphere &s)
+    {
+        glm::vec3 center(s.s.x, s.s.y, s.s.z);
+        return {center - glm::vec3(s.s.w) - eps, center + glm::vec3(s.s.w) + eps};
+    }
+
+    inline Aabb objectBoundingBox(const Object0 &object)
+    {
+        switch (object.type)
+        {
+        case GpuModel::SpherePrimitive:
+            return objectBoundingBox(object.s);
+        case GpuModel::InstancePrimitive:
+            return object.box;
+        default:
+            return objectBoundingBox(object.t);
+        }
+    }
+
+    // Rows of the 3x4 part of an affine transform, as stored in GpuModel::Instance.
+    inline void transformRows(const glm::mat4 &transform, glm::vec4 rows[3])
+    {
+        for (int r = 0; r < 3; r++)
+        {
+            rows[r] = glm::vec4(transform[0][r], transform[1][r], transform[2][r], transform[3][r]);
+        }
+    }
+
+    inline glm::vec3 transformPoint(const glm::vec4 rows[3], const glm::vec3 &p)
+    {
+        glm::vec4 p1(p, 1.0f);
+        return glm::vec3(glm::dot(rows[0], p1), glm::dot(rows[1], p1), glm::dot(rows[2], p1));
+    }
+
+    // World box of an instance of a mesh with the given object space box.
+    inline Aabb instanceBoundingBox(const GpuModel::Instance &instance, const Aabb &meshBox)
+    {
+        Aabb box;
+        for (int corner = 0; corner < 8; corner++)
+        {
+            glm::vec3 p((corner & 1) ? meshBox.max.x : meshBox.min.x,
+                        (corner & 2) ? meshBox.max.y : meshBox.min.y,
+                        (corner & 4) ? meshBox.max.z : meshBox.min.z);
+            box.grow(transformPoint(instance.objectToWorld, p));
+        }
+        return box;
+    }
+
     Aabb objectListBoundingBox(std::vector<Object0> &objects)
     {
         Aabb tempBox;
@@ -105,7 +214,7 @@ namespace Bvh
 
         for (auto &object : objects)
         {
-            tempBox = objectBoundingBox(object.t);
+            tempBox = objectBoundingBox(object);
             outputBox = firstBox ? tempBox : surroundingBox(outputBox, tempBox);
             firstBox = false;
         }
@@ -113,7 +222,7 @@ namespace Bvh
         return outputBox;
     }
 
-    inline bool boxCompare(GpuModel::Triangle &a, GpuModel::Triangle &b, int axis)
+    inline bool boxCompare(const Object0 &a, const Object0 &b, int axis)
     {
         Aabb boxA = objectBoundingBox(a);
         Aabb boxB = objectBoundingBox(b);
@@ -123,22 +232,23 @@ namespace Bvh
 
     bool boxXCompare(Object0 a, Object0 b)
     {
-        return boxCompare(a.t, b.t, 0);
+        return boxCompare(a, b, 0);
     }
 
     bool boxYCompare(Object0 a, Object0 b)
     {
-        return boxCompare(a.t, b.t, 1);
+        return boxCompare(a, b, 1);
     }
 
     bool boxZCompare(Object0 a, Object0 b)
     {
-        return boxCompare(a.t, b.t, 2);
+        return boxCompare(a, b, 2);
     }
 
     // Since GPU can't deal with tree structures we need to create a flattened BVH.
     // Stack is used instead of a tree.
-    std::vector<GpuModel::BvhNode> createBvh(const std::vector<Object0> &srcObjects)
+    // Objects of every leaf are appended to orderedObjects, leaves reference a range in it.
+    std::vector<GpuModel::BvhNode> createBvh(const std::vector<Object0> &srcObjects, std::vector<Object0> &orderedObjects, int maxLeafSize)
     {
         std::vector<BvhNode0> intermediate;
         int nodeCounter = 0;
@@ -165,8 +275,10 @@ namespace Bvh
             size_t objectSpan = currentNode.objects.size();
             std::sort(currentNode.objects.begin(), currentNode.objects.end(), comparator);
 
-            if (objectSpan <= 1)
+            if (objectSpan <= std::max(maxLeafSize, 1))
             {
+                currentNode.firstObjectIndex = orderedObjects.size();
+                orderedObjects.insert(orderedObjects.end(), currentNode.objects.begin(), currentNode.objects.end());
                 intermediate.push_back(currentNode);
                 continue;
             }
@@ -207,4 +319,1172 @@ namespace Bvh
         }
         return output;
     }
+
+    // Splitting plane chosen by the SAH builder.
+    struct SahSplit
+    {
+        int axis = -1;
+        // Objects with centroid bin < bin go to the left child.
+        int bin = 0;
+        float cost = FLT_MAX;
+        // Mapping of centroids on the split axis to bins.
+        float axisMin = 0.0f;
+        float axisScale = 0.0f;
+    };
+
+    struct SahBin
+    {
+        Aabb box;
+        int count = 0;
+    };
+
+    inline int sahBinIndex(float centroid, float axisMin, float axisScale, int numBins)
+    {
+        int bin = int((centroid - axisMin) * axisScale);
+        return std::min(std::max(bin, 0), numBins - 1);
+    }
+
+    // Evaluates binned SAH candidates on all three axes for objects[start, end).
+    inline SahSplit findSahSplit(const std::vector<uint32_t> &objects,
+                                 size_t start,
+                                 size_t end,
+                                 const std::vector<Aabb> &boxes,
+                                 const std::vector<glm::vec3> &centroids,
+                                 const Aabb &nodeBox,
+                                 const BuildOptions &options)
+    {
+        Aabb centroidBox;
+        for (size_t i = start; i < end; i++)
+        {
+            centroidBox.grow(centroids[objects[i]]);
+        }
+
+        const int numBins = std::max(options.sahBins, 2);
+        float invArea = 1.0f / std::max(nodeBox.surfaceArea(), FLT_MIN);
+
+        SahSplit best;
+        std::vector<SahBin> bins(numBins);
+        std::vector<float> rightCost(numBins);
+        for (int axis = 0; axis < 3; axis++)
+        {
+            float extent = centroidBox.max[axis] - centroidBox.min[axis];
+            if (extent <= 0.0f)
+            {
+                continue;
+            }
+            float axisScale = numBins / extent;
+
+            std::fill(bins.begin(), bins.end(), SahBin());
+            for (size_t i = start; i < end; i++)
+            {
+                uint32_t o = objects[i];
+                SahBin &bin = bins[sahBinIndex(centroids[o][axis], centroidBox.min[axis], axisScale, numBins)];
+                bin.box.grow(boxes[o]);
+                bin.count++;
+            }
+
+            // Sweep from the right to get area * count of every right partition, then from the left.
+            Aabb rightBox;
+            int rightCount = 0;
+            for (int b = numBins - 1; b > 0; b--)
+            {
+                rightBox.grow(bins[b].box);
+                rightCount += bins[b].count;
+                rightCost[b] = rightCount == 0 ? 0.0f : rightBox.surfaceArea() * rightCount;
+            }
+
+            Aabb leftBox;
+            int leftCount = 0;
+            for (int b = 1; b < numBins; b++)
+            {
+                leftBox.grow(bins[b - 1].box);
+                leftCount += bins[b - 1].count;
+                if (leftCount == 0 || leftCount == int(end - start))
+                {
+                    continue;
+                }
+                float cost = options.traversalCost +
+                             options.intersectionCost * (leftBox.surfaceArea() * leftCount + rightCost[b]) * invArea;
+                if (cost < best.cost)
+                {
+                    best.axis = axis;
+                    best.bin = b;
+                    best.cost = cost;
+                    best.axisMin = centroidBox.min[axis];
+                    best.axisScale = axisScale;
+                }
+            }
+        }
+        return best;
+    }
+
+    // Splits objects[start, end) in place and returns the index of the first object of the right half.
+    inline size_t partitionObjects(std::vector<uint32_t> &objects,
+                                   size_t start,
+                                   size_t end,
+                                   const std::vector<glm::vec3> &centroids,
+                                   const Aabb &nodeBox,
+                                   const SahSplit &split,
+                                   const BuildOptions &options)
+    {
+        if (split.axis != -1)
+        {
+            const int numBins = std::max(options.sahBins, 2);
+            auto mid = std::partition(objects.begin() + start, objects.begin() + end, [&](uint32_t o)
+                                      { return sahBinIndex(centroids[o][split.axis], split.axisMin, split.axisScale, numBins) < split.bin; });
+            return mid - objects.begin();
+        }
+
+        // All centroids coincide, no plane separates them. Fall back to a median split.
+        size_t mid = (start + end) / 2;
+        int axis = nodeBox.longestAxis();
+        std::nth_element(objects.begin() + start, objects.begin() + mid, objects.begin() + end, [&](uint32_t a, uint32_t b)
+                         { return centroids[a][axis] < centroids[b][axis]; });
+        return mid;
+    }
+
+    // Objects of a SAH build. Objects are referenced by their position in srcObjects and partitioned in place,
+    // so no triangles are copied while building.
+    struct SahBuildState
+    {
+        std::vector<uint32_t> objects;
+        std::vector<Aabb> boxes;
+        std::vector<glm::vec3> centroids;
+    };
+
+    // Range of objects that is built into a separate subtree by the parallel builder.
+    struct DeferredSubtree
+    {
+        // Placeholder node in the top of the tree.
+        int nodeIndex;
+        size_t start;
+        size_t end;
+    };
+
+    // Runs func(i) for i in [0, count) on a pool of numThreads worker threads.
+    template <typename Func>
+    void parallelFor(size_t count, unsigned numThreads, Func func)
+    {
+        std::atomic<size_t> next{0};
+        auto worker = [&]()
+        {
+            for (size_t i = next++; i < count; i = next++)
+            {
+                func(i);
+            }
+        };
+
+        std::vector<std::thread> workers;
+        for (unsigned t = 1; t < std::min<size_t>(numThreads, count); t++)
+        {
+            workers.emplace_back(worker);
+        }
+        worker();
+        for (auto &thread : workers)
+        {
+            thread.join();
+        }
+    }
+
+    inline unsigned buildThreadCount(const BuildOptions &options)
+    {
+        if (options.buildThreads > 0)
+        {
+            return options.buildThreads;
+        }
+        return std::max(std::thread::hardware_concurrency(), 1u);
+    }
+
+    inline void initSahBuildState(SahBuildState &state, const std::vector<Object0> &srcObjects, unsigned numThreads)
+    {
+        size_t count = srcObjects.size();
+        state.objects.resize(count);
+        state.boxes.resize(count);
+        state.centroids.resize(count);
+        std::iota(state.objects.begin(), state.objects.end(), 0);
+
+        const size_t chunkSize = 4096;
+        parallelFor((count + chunkSize - 1) / chunkSize, numThreads, [&](size_t chunk)
+                    {
+                        for (size_t i = chunk * chunkSize; i < std::min(count, (chunk + 1) * chunkSize); i++)
+                        {
+                            state.boxes[i] = objectBoundingBox(srcObjects[i]);
+                            state.centroids[i] = state.boxes[i].centroid();
+                        } });
+    }
+
+    // Builds the subtree over objects[start, end) and appends its nodes to output in depth-first order,
+    // so the left child of an inner node always directly follows it. Child links are relative to the start of output.
+    // If deferred is set, ranges of at most deferSize objects are not built but left as placeholder nodes.
+    inline void buildSahSubtree(SahBuildState &state,
+                                size_t start,
+                                size_t end,
+                                const BuildOptions &options,
+                                std::vector<GpuModel::BvhNode> &output,
+                                size_t deferSize = 0,
+                                std::vector<DeferredSubtree> *deferred = nullptr)
+    {
+        struct BuildTask
+        {
+            size_t start;
+            size_t end;
+            // Node that has to be linked to the node built from this task.
+            int parentIndex;
+            bool isRightChild;
+        };
+
+        std::stack<BuildTask> taskStack;
+        taskStack.push({start, end, -1, false});
+
+        while (!taskStack.empty())
+        {
+            BuildTask task = taskStack.top();
+            taskStack.pop();
+
+            int nodeIndex = output.size();
+            output.emplace_back();
+            if (task.parentIndex != -1)
+            {
+                if (task.isRightChild)
+                {
+                    output[task.parentIndex].rightNodeIndex = nodeIndex;
+                }
+                else
+                {
+                    output[task.parentIndex].leftNodeIndex = nodeIndex;
+                }
+            }
+
+            size_t objectSpan = task.end - task.start;
+            if (deferred != nullptr && objectSpan <= deferSize)
+            {
+                deferred->push_back({nodeIndex, task.start, task.end});
+                continue;
+            }
+
+            Aabb box;
+            for (size_t i = task.start; i < task.end; i++)
+            {
+                box.grow(state.boxes[state.objects[i]]);
+            }
+            output[nodeIndex].min = box.min;
+            output[nodeIndex].max = box.max;
+
+            SahSplit split;
+            if (objectSpan > 1)
+            {
+                split = findSahSplit(state.objects, task.start, task.end, state.boxes, state.centroids, box, options);
+            }
+
+            // Make a leaf when it is cheaper to intersect all objects than to split them any further.
+            float leafCost = options.intersectionCost * objectSpan;
+            if (objectSpan <= 1 || (objectSpan <= size_t(options.maxLeafSize) && leafCost <= split.cost))
+            {
+                // Ranges of finished leaves are never touched again, so they keep their place in objects.
+                output[nodeIndex].objectIndex = task.start;
+                output[nodeIndex].objectCount = objectSpan;
+                continue;
+            }
+
+            size_t mid = partitionObjects(state.objects, task.start, task.end, state.centroids, box, split, options);
+
+            // Right child is pushed first so that the left subtree is emitted right after its parent.
+            taskStack.push({mid, task.end, nodeIndex, true});
+            taskStack.push({task.start, mid, nodeIndex, false});
+        }
+    }
+
+    inline void getOrderedObjects(const SahBuildState &state, const std::vector<Object0> &srcObjects, std::vector<Object0> &orderedObjects)
+    {
+        orderedObjects.clear();
+        orderedObjects.reserve(state.objects.size());
+        for (uint32_t object : state.objects)
+        {
+            orderedObjects.push_back(srcObjects[object]);
+        }
+    }
+
+    // Builds a flattened Bvh with binned SAH splits on the calling thread.
+    // orderedObjects receives srcObjects in leaf order, leaves reference a range in it.
+    inline std::vector<GpuModel::BvhNode> createSahBvh(const std::vector<Object0> &srcObjects,
+                                                       std::vector<Object0> &orderedObjects,
+                                                       const BuildOptions &options)
+    {
+        std::vector<GpuModel::BvhNode> output;
+        orderedObjects.clear();
+        if (srcObjects.empty())
+        {
+            return output;
+        }
+
+        SahBuildState state;
+        initSahBuildState(state, srcObjects, 1);
+        output.reserve(2 * srcObjects.size());
+        buildSahSubtree(state, 0, srcObjects.size(), options, output);
+
+        getOrderedObjects(state, srcObjects, orderedObjects);
+        return output;
+    }
+
+    // Parallel version of createSahBvh, produces exactly the same nodes and object order.
+    // The top of the tree is built on the calling thread until the remaining ranges are small enough,
+    // then the subtrees are built by a pool of worker threads and spliced into the top in depth-first order.
+    inline std::vector<GpuModel::BvhNode> createParallelSahBvh(const std::vector<Object0> &srcObjects,
+                                                               std::vector<Object0> &orderedObjects,
+                                                               const BuildOptions &options)
+    {
+        unsigned numThreads = buildThreadCount(options);
+        if (numThreads <= 1)
+        {
+            return createSahBvh(srcObjects, orderedObjects, options);
+        }
+
+        std::vector<GpuModel::BvhNode> output;
+        orderedObjects.clear();
+        if (srcObjects.empty())
+        {
+            return output;
+        }
+
+        SahBuildState state;
+        initSahBuildState(state, srcObjects, numThreads);
+
+        // Several subtrees per thread keep the workers busy when the tree is unbalanced.
+        size_t deferSize = std::max<size_t>(srcObjects.size() / (8 * numThreads), options.maxLeafSize);
+        std::vector<GpuModel::BvhNode> top;
+        std::vector<DeferredSubtree> deferred;
+        buildSahSubtree(state, 0, srcObjects.size(), options, top, deferSize, &deferred);
+
+        // Subtrees work on disjoint object ranges, so they can partition the shared object array concurrently.
+        std::vector<std::vector<GpuModel::BvhNode> > subtrees(deferred.size());
+        std::vector<size_t> buildOrder(deferred.size());
+        std::iota(buildOrder.begin(), buildOrder.end(), 0);
+        std::sort(buildOrder.begin(), buildOrder.end(), [&](size_t a, size_t b)
+                  { return deferred[a].end - deferred[a].start > deferred[b].end - deferred[b].start; });
+        parallelFor(deferred.size(), numThreads, [&](size_t i)
+                    {
+                        const DeferredSubtree &subtree = deferred[buildOrder[i]];
+                        buildSahSubtree(state, subtree.start, subtree.end, options, subtrees[buildOrder[i]]);
+                    });
+
+        // Final index of every top node, a placeholder is replaced by the whole subtree.
+        std::vector<int> finalIndex(top.size());
+        std::vector<int> subtreeOfNode(top.size(), -1);
+        for (size_t i = 0; i < deferred.size(); i++)
+        {
+            subtreeOfNode[deferred[i].nodeIndex] = i;
+        }
+        int nodeCount = 0;
+        for (size_t i = 0; i < top.size(); i++)
+        {
+            finalIndex[i] = nodeCount;
+            nodeCount += subtreeOfNode[i] == -1 ? 1 : subtrees[subtreeOfNode[i]].size();
+        }
+
+        output.reserve(nodeCount);
+        for (size_t i = 0; i < top.size(); i++)
+        {
+            if (subtreeOfNode[i] == -1)
+            {
+                GpuModel::BvhNode node = top[i];
+                if (node.leftNodeIndex != -1)
+                {
+                    node.leftNodeIndex = finalIndex[node.leftNodeIndex];
+                    node.rightNodeIndex = finalIndex[node.rightNodeIndex];
+                }
+                output.push_back(node);
+                continue;
+            }
+
+            for (GpuModel::BvhNode node : subtrees[subtreeOfNode[i]])
+            {
+                if (node.leftNodeIndex != -1)
+                {
+                    node.leftNodeIndex += finalIndex[i];
+                    node.rightNodeIndex += finalIndex[i];
+                }
+                output.push_back(node);
+            }
+        }
+
+        getOrderedObjects(state, srcObjects, orderedObjects);
+        return output;
+    }
+
+    // Spreads the lower 10 bits of v so that there are two zero bits between each of them.
+    inline uint32_t expandBits(uint32_t v)
+    {
+        v = (v * 0x00010001u) & 0xFF0000FFu;
+        v = (v * 0x00000101u) & 0x0F00F00Fu;
+        v = (v * 0x00000011u) & 0xC30C30C3u;
+        v = (v * 0x00000005u) & 0x49249249u;
+        return v;
+    }
+
+    // 30 bit Morton code of a point in the unit cube.
+    inline uint32_t mortonCode(const glm::vec3 &p)
+    {
+        glm::vec3 q = glm::clamp(p * 1024.0f, 0.0f, 1023.0f);
+        return (expandBits(uint32_t(q.x)) << 2) | (expandBits(uint32_t(q.y)) << 1) | expandBits(uint32_t(q.z));
+    }
+
+    // Sorts objects by their Morton codes with a stable LSD radix sort, 10 bits per pass.
+    inline void radixSortMorton(std::vector<uint32_t> &codes, std::vector<uint32_t> &objects)
+    {
+        const int bitsPerPass = 10;
+        const uint32_t numBuckets = 1u << bitsPerPass;
+        std::vector<uint32_t> tempCodes(codes.size());
+        std::vector<uint32_t> tempObjects(objects.size());
+        std::vector<size_t> offsets(numBuckets);
+
+        for (int shift = 0; shift < 30; shift += bitsPerPass)
+        {
+            std::fill(offsets.begin(), offsets.end(), 0);
+            for (uint32_t code : codes)
+            {
+                offsets[(code >> shift) & (numBuckets - 1)]++;
+            }
+            size_t sum = 0;
+            for (auto &offset : offsets)
+            {
+                size_t count = offset;
+                offset = sum;
+                sum += count;
+            }
+            for (size_t i = 0; i < codes.size(); i++)
+            {
+                size_t dst = offsets[(codes[i] >> shift) & (numBuckets - 1)]++;
+                tempCodes[dst] = codes[i];
+                tempObjects[dst] = objects[i];
+            }
+            codes.swap(tempCodes);
+            objects.swap(tempObjects);
+        }
+    }
+
+    // Index of the first code in sorted codes[start, end) that differs from codes[start] in the highest differing bit.
+    // Ranges with equal codes are split in the middle.
+    inline size_t findMortonSplit(const std::vector<uint32_t> &codes, size_t start, size_t end)
+    {
+        uint32_t first = codes[start];
+        uint32_t last = codes[end - 1];
+        if (first == last)
+        {
+            return (start + end) / 2;
+        }
+
+        uint32_t highestBit = 0;
+        for (uint32_t diff = first ^ last; diff > 1; diff >>= 1)
+        {
+            highestBit++;
+        }
+        uint32_t mask = ~((1u << highestBit) - 1);
+        uint32_t rightPrefix = last & mask;
+        return std::lower_bound(codes.begin() + start, codes.begin() + end, rightPrefix) - codes.begin();
+    }
+
+    // Builds a linear bvh: objects are sorted along a Morton curve over their centroids,
+    // and every node is split where the highest bit of the codes in its range changes.
+    // Nodes are emitted in depth-first order like createSahBvh, orderedObjects receives the objects in Morton order.
+    inline std::vector<GpuModel::BvhNode> createLbvh(const std::vector<Object0> &srcObjects,
+                                                     std::vector<Object0> &orderedObjects,
+                                                     const BuildOptions &options)
+    {
+        std::vector<GpuModel::BvhNode> output;
+        orderedObjects.clear();
+        if (srcObjects.empty())
+        {
+            return output;
+        }
+
+        SahBuildState state;
+        initSahBuildState(state, srcObjects, buildThreadCount(options));
+
+        Aabb centroidBox;
+        for (auto &centroid : state.centroids)
+        {
+            centroidBox.grow(centroid);
+        }
+        glm::vec3 scale = 1.0f / glm::max(centroidBox.max - centroidBox.min, glm::vec3(FLT_MIN));
+
+        std::vector<uint32_t> codes(srcObjects.size());
+        for (size_t i = 0; i < codes.size(); i++)
+        {
+            codes[i] = mortonCode((state.centroids[i] - centroidBox.min) * scale);
+        }
+        radixSortMorton(codes, state.objects);
+
+        struct BuildTask
+        {
+            size_t start;
+            size_t end;
+            int parentIndex;
+            bool isRightChild;
+        };
+
+        std::stack<BuildTask> taskStack;
+        taskStack.push({0, codes.size(), -1, false});
+        output.reserve(2 * codes.size());
+        size_t maxLeafSize = std::max(options.maxLeafSize, 1);
+
+        while (!taskStack.empty())
+        {
+            BuildTask task = taskStack.top();
+            taskStack.pop();
+
+            int nodeIndex = output.size();
+            output.emplace_back();
+            if (task.parentIndex != -1)
+            {
+                if (task.isRightChild)
+                {
+                    output[task.parentIndex].rightNodeIndex = nodeIndex;
+                }
+                else
+                {
+                    output[task.parentIndex].leftNodeIndex = nodeIndex;
+                }
+            }
+
+            if (task.end - task.start <= maxLeafSize)
+            {
+                output[nodeIndex].objectIndex = task.start;
+                output[nodeIndex].objectCount = task.end - task.start;
+                continue;
+            }
+
+            size_t mid = findMortonSplit(codes, task.start, task.end);
+            taskStack.push({mid, task.end, nodeIndex, true});
+            taskStack.push({task.start, mid, nodeIndex, false});
+        }
+
+        // Children always come after their parent, so boxes can be computed bottom-up in a single reverse pass.
+        for (size_t i = output.size(); i-- > 0;)
+        {
+            GpuModel::BvhNode &node = output[i];
+            Aabb box;
+            if (node.leftNodeIndex == -1)
+            {
+                for (int j = node.objectIndex; j < node.objectIndex + node.objectCount; j++)
+                {
+                    box.grow(state.boxes[state.objects[j]]);
+                }
+            }
+            else
+            {
+                box = surroundingBox({output[node.leftNodeIndex].min, output[node.leftNodeIndex].max},
+                                     {output[node.rightNodeIndex].min, output[node.rightNodeIndex].max});
+            }
+            node.min = box.min;
+            node.max = box.max;
+        }
+
+        getOrderedObjects(state, srcObjects, orderedObjects);
+        return output;
+    }
+
+    // Expected cost of tracing a ray through the bvh according to the SAH cost model, relative to the root box.
+    // Lower is better, useful for comparing builders on the same scene.
+    inline float sahCost(const std::vector<GpuModel::BvhNode> &nodes, const BuildOptions &options)
+    {
+        if (nodes.empty())
+        {
+            return 0.0f;
+        }
+
+        float rootArea = Aabb{nodes[0].min, nodes[0].max}.surfaceArea();
+        float cost = 0.0f;
+        for (auto &node : nodes)
+        {
+            float area = Aabb{node.min, node.max}.surfaceArea();
+            bool leaf = node.leftNodeIndex == -1 && node.rightNodeIndex == -1;
+            cost += area * (leaf ? options.intersectionCost * node.objectCount : options.traversalCost);
+        }
+        return cost / std::max(rootArea, FLT_MIN);
+    }
+
+    // Builds a bvh with the builder selected in options.
+    // Leaves reference ranges in orderedObjects, which is a permutation of srcObjects.
+    inline std::vector<GpuModel::BvhNode> build(const std::vector<Object0> &srcObjects,
+                                                std::vector<Object0> &orderedObjects,
+                                                const BuildOptions &options)
+    {
+        orderedObjects.clear();
+        switch (options.builder)
+        {
+        case BuilderType::RandomMedian:
+            return createBvh(srcObjects, orderedObjects, options.maxLeafSize);
+        case BuilderType::Lbvh:
+            return createLbvh(srcObjects, orderedObjects, options);
+        case BuilderType::BinnedSah:
+        default:
+            return createParallelSahBvh(srcObjects, orderedObjects, options);
+        }
+    }
+
+    // Makes every leaf reference primitives of a single type, so the shader doesn't need to look up the type of
+    // every primitive. Leaves with mixed types are split into an inner node with a leaf for the first type and
+    // a leaf for the rest, which is split again if needed. New nodes are appended to nodes.
+    // Afterwards objectIndex of a leaf is an index in the array of its type: triangles, spheres and instances are
+    // stored in separate arrays, each in the order in which they appear in orderedObjects.
+    inline void splitPrimitiveTypes(std::vector<GpuModel::BvhNode> &nodes, std::vector<Object0> &orderedObjects)
+    {
+        auto typeCompare = [](const Object0 &a, const Object0 &b)
+        { return a.type < b.type; };
+
+        for (size_t i = 0; i < nodes.size(); i++)
+        {
+            if (nodes[i].leftNodeIndex != -1)
+            {
+                continue;
+            }
+
+            auto first = orderedObjects.begin() + nodes[i].objectIndex;
+            auto last = first + nodes[i].objectCount;
+            std::stable_sort(first, last, typeCompare);
+            auto split = std::upper_bound(first, last, *first, typeCompare);
+            if (split == last)
+            {
+                continue;
+            }
+
+            GpuModel::BvhNode typeLeaf;
+            GpuModel::BvhNode restLeaf;
+            typeLeaf.objectIndex = nodes[i].objectIndex;
+            typeLeaf.objectCount = split - first;
+            restLeaf.objectIndex = nodes[i].objectIndex + typeLeaf.objectCount;
+            restLeaf.objectCount = last - split;
+            for (GpuModel::BvhNode *leaf : {&typeLeaf, &restLeaf})
+            {
+                Aabb box;
+                for (int j = leaf->objectIndex; j < leaf->objectIndex + leaf->objectCount; j++)
+                {
+                    box.grow(objectBoundingBox(orderedObjects[j]));
+                }
+                leaf->min = box.min;
+                leaf->max = box.max;
+            }
+
+            nodes[i].leftNodeIndex = nodes.size();
+            nodes[i].rightNodeIndex = nodes.size() + 1;
+            nodes[i].objectIndex = -1;
+            nodes[i].objectCount = 0;
+            nodes.push_back(typeLeaf);
+            nodes.push_back(restLeaf);
+        }
+
+        // Index of every object in the array of its type.
+        std::vector<int> typeIndices(orderedObjects.size());
+        int typeCounts[3] = {0, 0, 0};
+        for (size_t i = 0; i < orderedObjects.size(); i++)
+        {
+            typeIndices[i] = typeCounts[orderedObjects[i].type]++;
+        }
+
+        for (auto &node : nodes)
+        {
+            if (node.leftNodeIndex == -1 && node.objectCount > 0)
+            {
+                node.objectType = orderedObjects[node.objectIndex].type;
+                node.objectIndex = typeIndices[node.objectIndex];
+            }
+        }
+    }
+
+    // Converts a bvh into compact nodes in depth-first order, where the left child of an inner node is the next node.
+    // Works for any node order of the builders, the root is expected at index 0.
+    // compactIndices receives the index of every node in the output if set, to update the boxes after a refit.
+    inline std::vector<GpuModel::CompactBvhNode> compact(const std::vector<GpuModel::BvhNode> &nodes,
+                                                         std::vector<int> *compactIndices = nullptr)
+    {
+        std::vector<GpuModel::CompactBvhNode> output;
+        output.reserve(nodes.size());
+        if (compactIndices)
+        {
+            compactIndices->assign(nodes.size(), -1);
+        }
+
+        struct CompactTask
+        {
+            int nodeIndex;
+            // Compact parent of a right child, that has to be linked to it. -1 for left children and the root.
+            int rightChildOf;
+        };
+
+        std::stack<CompactTask> taskStack;
+        if (!nodes.empty())
+        {
+            taskStack.push({0, -1});
+        }
+
+        while (!taskStack.empty())
+        {
+            CompactTask task = taskStack.top();
+            taskStack.pop();
+
+            const GpuModel::BvhNode &node = nodes[task.nodeIndex];
+            int index = output.size();
+            if (task.rightChildOf != -1)
+            {
+                output[task.rightChildOf].offset = index;
+            }
+            if (compactIndices)
+            {
+                (*compactIndices)[task.nodeIndex] = index;
+            }
+
+            GpuModel::CompactBvhNode compactNode;
+            compactNode.min = node.min;
+            compactNode.max = node.max;
+            if (node.leftNodeIndex == -1)
+            {
+                compactNode.offset = node.objectIndex;
+                compactNode.count = node.objectCount | (node.objectType << GpuModel::PrimitiveTypeShift);
+            }
+            output.push_back(compactNode);
+
+            if (node.leftNodeIndex != -1)
+            {
+                taskStack.push({node.rightNodeIndex, index});
+                taskStack.push({node.leftNodeIndex, -1});
+            }
+        }
+        return output;
+    }
+
+    // Size of one quantization step of a frame box on every axis, there are 255 steps from min to max.
+    // Has to be computed exactly like in the shader.
+    inline glm::vec3 quantizationStep(const Aabb &frame)
+    {
+        return (frame.max - frame.min) * (1.0f / 255.0f);
+    }
+
+    // Quantizes box on every axis relative to frame. Bounds are rounded outwards, so the decoded box always contains box
+    // grown by tolerance, which covers rounding differences between the CPU and GPU decoding.
+    inline Aabb quantizeBox(const Aabb &box, const Aabb &frame, float tolerance, uint8_t qMin[3], uint8_t qMax[3])
+    {
+        glm::vec3 step = quantizationStep(frame);
+        Aabb decoded;
+        for (int axis = 0; axis < 3; axis++)
+        {
+            auto dequantize = [&](int q)
+            { return frame.min[axis] + float(q) * step[axis]; };
+
+            float lo = box.min[axis] - tolerance;
+            float hi = box.max[axis] + tolerance;
+            int q0 = std::min(std::max(int(std::floor((lo - frame.min[axis]) / step[axis])), 0), 255);
+            int q1 = std::min(std::max(int(std::ceil((hi - frame.min[axis]) / step[axis])), 0), 255);
+            while (q0 > 0 && dequantize(q0) > lo)
+            {
+                q0--;
+            }
+            while (q1 < 255 && dequantize(q1) < hi)
+            {
+                q1++;
+            }
+
+            qMin[axis] = q0;
+            qMax[axis] = q1;
+            decoded.min[axis] = dequantize(q0);
+            decoded.max[axis] = dequantize(q1);
+        }
+        return decoded;
+    }
+
+    // Encodes compact nodes into quantized nodes with the same indices.
+    // rootBox receives the box of the root, which has to be passed to the shader separately.
+    inline std::vector<GpuModel::QuantizedBvhNode> quantize(const std::vector<GpuModel::CompactBvhNode> &nodes, Aabb &rootBox)
+    {
+        std::vector<GpuModel::QuantizedBvhNode> output(nodes.size());
+        if (nodes.empty())
+        {
+            return output;
+        }
+
+        // Decoding on GPU may round differently by a few ulps of the biggest coordinate in the scene.
+        glm::vec3 magnitude = glm::max(glm::abs(nodes[0].min), glm::abs(nodes[0].max));
+        float tolerance = std::max(std::max(magnitude.x, magnitude.y), magnitude.z) * 1e-6f;
+        rootBox = {nodes[0].min - glm::vec3(2.0f * tolerance), nodes[0].max + glm::vec3(2.0f * tolerance)};
+
+        struct QuantizeTask
+        {
+            int nodeIndex;
+            // Box of the node as decoded by the traversal.
+            Aabb frame;
+        };
+
+        std::stack<QuantizeTask> taskStack;
+        taskStack.push({0, rootBox});
+        while (!taskStack.empty())
+        {
+            QuantizeTask task = taskStack.top();
+            taskStack.pop();
+
+            const GpuModel::CompactBvhNode &node = nodes[task.nodeIndex];
+            GpuModel::QuantizedBvhNode &quantized = output[task.nodeIndex];
+            if (node.count > 0)
+            {
+                quantized.data[0] = node.offset;
+                quantized.data[1] = node.count;
+                quantized.rightNodeIndex = GpuModel::QuantizedLeaf;
+                continue;
+            }
+
+            int children[2] = {task.nodeIndex + 1, node.offset};
+            uint8_t bytes[12];
+            for (int c = 0; c < 2; c++)
+            {
+                const GpuModel::CompactBvhNode &child = nodes[children[c]];
+                Aabb decoded = quantizeBox({child.min, child.max}, task.frame, tolerance, &bytes[6 * c], &bytes[6 * c + 3]);
+                taskStack.push({children[c], decoded});
+            }
+            for (int i = 0; i < 3; i++)
+            {
+                quantized.data[i] = bytes[4 * i] | (bytes[4 * i + 1] << 8) | (bytes[4 * i + 2] << 16) | (uint32_t(bytes[4 * i + 3]) << 24);
+            }
+            quantized.rightNodeIndex = node.offset;
+        }
+        return output;
+    }
+
+    // Converts compact nodes into a roped bvh for stackless traversal. The hit link of every node is the next node,
+    // like in the compact layout. Inner nodes store the miss link in offset instead of the right child: the node
+    // after their subtree, where the traversal continues when their box is missed. The miss link of a leaf is
+    // always the next node, so leaves keep their triangle range. The miss link of the root is the number of nodes.
+    inline std::vector<GpuModel::CompactBvhNode> rope(const std::vector<GpuModel::CompactBvhNode> &nodes)
+    {
+        std::vector<GpuModel::CompactBvhNode> output = nodes;
+        std::vector<int> missLinks(nodes.size(), nodes.size());
+        // Parents come before their children in depth-first order.
+        for (size_t i = 0; i < nodes.size(); i++)
+        {
+            if (nodes[i].count == 0)
+            {
+                int right = nodes[i].offset;
+                missLinks[i + 1] = right;
+                missLinks[right] = missLinks[i];
+                output[i].offset = missLinks[i];
+            }
+        }
+        return output;
+    }
+
+    // Collapses a compact binary bvh into a 4-wide bvh. Every wide node takes the children of a binary inner node
+    // and keeps replacing its inner child with the biggest surface area by the two children of that child, until
+    // all slots are used or only leaves are left. Leaves keep their triangle ranges.
+    inline std::vector<GpuModel::WideBvhNode> collapse(const std::vector<GpuModel::CompactBvhNode> &nodes)
+    {
+        std::vector<GpuModel::WideBvhNode> output;
+        if (nodes.empty())
+        {
+            return output;
+        }
+        output.reserve(nodes.size() / 2 + 1);
+
+        struct CollapseTask
+        {
+            int nodeIndex;
+            int wideIndex;
+        };
+
+        std::stack<CollapseTask> taskStack;
+        output.emplace_back();
+        taskStack.push({0, 0});
+        while (!taskStack.empty())
+        {
+            CollapseTask task = taskStack.top();
+            taskStack.pop();
+
+            // A leaf root becomes a single leaf child.
+            std::vector<int> children;
+            const GpuModel::CompactBvhNode &node = nodes[task.nodeIndex];
+            if (node.count > 0)
+            {
+                children = {task.nodeIndex};
+            }
+            else
+            {
+                children = {task.nodeIndex + 1, node.offset};
+            }
+
+            while ((int)children.size() < GpuModel::BvhWidth)
+            {
+                int best = -1;
+                float bestArea = -1.0f;
+                for (int c = 0; c < (int)children.size(); c++)
+                {
+                    const GpuModel::CompactBvhNode &child = nodes[children[c]];
+                    float area = Aabb{child.min, child.max}.surfaceArea();
+                    if (child.count == 0 && area > bestArea)
+                    {
+                        best = c;
+                        bestArea = area;
+                    }
+                }
+                if (best == -1)
+                {
+                    break;
+                }
+                int opened = children[best];
+                children[best] = opened + 1;
+                children.push_back(nodes[opened].offset);
+            }
+
+            for (int c = 0; c < (int)children.size(); c++)
+            {
+                const GpuModel::CompactBvhNode &child = nodes[children[c]];
+                int childIndex = child.offset;
+                if (child.count == 0)
+                {
+                    childIndex = output.size();
+                    output.emplace_back();
+                    taskStack.push({children[c], childIndex});
+                }
+
+                // output may have been reallocated by emplace_back.
+                GpuModel::WideBvhNode &wide = output[task.wideIndex];
+                wide.minX[c] = child.min.x;
+                wide.minY[c] = child.min.y;
+                wide.minZ[c] = child.min.z;
+                wide.maxX[c] = child.max.x;
+                wide.maxY[c] = child.max.y;
+                wide.maxZ[c] = child.max.z;
+                wide.child[c] = childIndex;
+                wide.count[c] = child.count;
+            }
+        }
+        return output;
+    }
+
+    // Number of stack entries the shader needs to traverse compact or quantized nodes from root without dropping any.
+    // Both children of an inner node are pushed, so a node at depth d is popped with at most d entries left on the stack.
+    // An instance leaf pushes all of its instances, and entering one pushes an exit marker and the root of its mesh.
+    // instanceStackSizes holds the stack size of the mesh of every instance. Nodes is any random access container of
+    // CompactBvhNode, so nodes read in place from the scene cache don't have to be copied.
+    template <typename Nodes>
+    inline int stackSize(const Nodes &nodes, int root = 0, const std::vector<int> &instanceStackSizes = {})
+    {
+        struct StackTask
+        {
+            int nodeIndex;
+            int depth;
+        };
+
+        int size = 0;
+        std::stack<StackTask> taskStack;
+        if (root < (int)nodes.size())
+        {
+            taskStack.push({root, 0});
+        }
+        while (!taskStack.empty())
+        {
+            StackTask task = taskStack.top();
+            taskStack.pop();
+
+            const GpuModel::CompactBvhNode &node = nodes[task.nodeIndex];
+            if (node.count == 0)
+            {
+                taskStack.push({task.nodeIndex + 1, task.depth + 1});
+                taskStack.push({node.offset, task.depth + 1});
+                continue;
+            }
+
+            int leafSize = task.depth + 1;
+            if ((node.count >> GpuModel::PrimitiveTypeShift) == GpuModel::InstancePrimitive)
+            {
+                int count = node.count & GpuModel::PrimitiveCountMask;
+                int meshSize = 0;
+                for (int i = node.offset; i < node.offset + count; i++)
+                {
+                    meshSize = std::max(meshSize, instanceStackSizes.at(i));
+                }
+                leafSize = task.depth + count + meshSize;
+            }
+            size = std::max(size, leafSize);
+        }
+        return size;
+    }
+
+    // stackSize of the wide traversal, which only pushes inner children. A node popped with pending entries on the stack
+    // pushes its k inner children, and every child is popped with at most pending + k - 1 entries left.
+    inline int wideStackSize(const std::vector<GpuModel::WideBvhNode> &nodes)
+    {
+        struct StackTask
+        {
+            int nodeIndex;
+            int pending;
+        };
+
+        int size = nodes.empty() ? 0 : 1;
+        std::stack<StackTask> taskStack;
+        if (!nodes.empty())
+        {
+            taskStack.push({0, 0});
+        }
+        while (!taskStack.empty())
+        {
+            StackTask task = taskStack.top();
+            taskStack.pop();
+
+            const GpuModel::WideBvhNode &node = nodes[task.nodeIndex];
+            int innerChildren = 0;
+            for (int c = 0; c < GpuModel::BvhWidth; c++)
+            {
+                innerChildren += node.count[c] == 0 ? 1 : 0;
+            }
+            size = std::max(size, task.pending + innerChildren);
+            for (int c = 0; c < GpuModel::BvhWidth; c++)
+            {
+                if (node.count[c] == 0)
+                {
+                    taskStack.push({node.child[c], task.pending + innerChildren - 1});
+                }
+            }
+        }
+        return size;
+    }
+
+    // Box of the primitives of a leaf, see refit.
+    inline Aabb leafBoundingBox(const GpuModel::BvhNode &leaf,
+                                const std::vector<GpuModel::Triangle> &triangles,
+                                const std::vector<GpuModel::Sphere> &spheres,
+                                const std::vector<Aabb> &instanceBoxes)
+    {
+        Aabb box;
+        for (int j = leaf.objectIndex; j < leaf.objectIndex + leaf.objectCount; j++)
+        {
+            switch (leaf.objectType)
+            {
+            case GpuModel::SpherePrimitive:
+                box.grow(objectBoundingBox(spheres[j]));
+                break;
+            case GpuModel::InstancePrimitive:
+                box.grow(instanceBoxes[j]);
+                break;
+            default:
+                box.grow(objectBoundingBox(triangles[j]));
+            }
+        }
+        return box;
+    }
+
+    // Recomputes node boxes bottom-up for moved primitives, keeping the topology of the tree.
+    // triangles, spheres and instance boxes are expected in leaf order, as split by splitPrimitiveTypes.
+    inline void refit(std::vector<GpuModel::BvhNode> &nodes,
+                      const std::vector<GpuModel::Triangle> &triangles,
+                      const std::vector<GpuModel::Sphere> &spheres,
+                      const std::vector<Aabb> &instanceBoxes = {})
+    {
+        // All builders place children after their parent, so a reverse pass visits children first.
+        for (size_t i = nodes.size(); i-- > 0;)
+        {
+            GpuModel::BvhNode &node = nodes[i];
+            Aabb box;
+            if (node.leftNodeIndex == -1)
+            {
+                box = leafBoundingBox(node, triangles, spheres, instanceBoxes);
+            }
+            else
+            {
+                box = surroundingBox({nodes[node.leftNodeIndex].min, nodes[node.leftNodeIndex].max},
+                                     {nodes[node.rightNodeIndex].min, nodes[node.rightNodeIndex].max});
+            }
+            node.min = box.min;
+            node.max = box.max;
+        }
+    }
+
+    // Refits only a leaf whose primitives moved and the nodes above it, parents as returned by parentIndices.
+    inline void refitLeaf(std::vector<GpuModel::BvhNode> &nodes,
+                          const std::vector<int> &parents,
+                          int leaf,
+                          const std::vector<GpuModel::Triangle> &triangles,
+                          const std::vector<GpuModel::Sphere> &spheres,
+                          const std::vector<Aabb> &instanceBoxes = {})
+    {
+        Aabb box = leafBoundingBox(nodes[leaf], triangles, spheres, instanceBoxes);
+        nodes[leaf].min = box.min;
+        nodes[leaf].max = box.max;
+        for (int i = parents[leaf]; i != -1; i = parents[i])
+        {
+            GpuModel::BvhNode &node = nodes[i];
+            box = surroundingBox({nodes[node.leftNodeIndex].min, nodes[node.leftNodeIndex].max},
+                                 {nodes[node.rightNodeIndex].min, nodes[node.rightNodeIndex].max});
+            node.min = box.min;
+            node.max = box.max;
+        }
+    }
+
+    // Index of the parent of every node, -1 for the root. Used to refit the bvh on GPU.
+    inline std::vector<int> parentIndices(const std::vector<GpuModel::BvhNode> &nodes)
+    {
+        std::vector<int> parents(nodes.size(), -1);
+        for (size_t i = 0; i < nodes.size(); i++)
+        {
+            if (nodes[i].leftNodeIndex != -1)
+            {
+                parents[nodes[i].leftNodeIndex] = i;
+                parents[nodes[i].rightNodeIndex] = i;
+            }
+        }
+        return parents;
+    }
+
+    inline std::vector<int> parentIndices(const std::vector<GpuModel::CompactBvhNode> &nodes)
+    {
+        std::vector<int> parents(nodes.size(), -1);
+        for (size_t i = 0; i < nodes.size(); i++)
+        {
+            if (nodes[i].count == 0)
+            {
+                parents[i + 1] = i;
+                parents[nodes[i].offset] = i;
+            }
+        }
+        return parents;
+    }
+
+    inline bool sameNodes(const std::vector<GpuModel::BvhNode> &a, const std::vector<GpuModel::BvhNode> &b)
+    {
+        return std::equal(a.begin(), a.end(), b.begin(), b.end(), [](const GpuModel::BvhNode &x, const GpuModel::BvhNode &y)
+                          { return x.min == y.min && x.max == y.max &&
+                                   x.leftNodeIndex == y.leftNodeIndex && x.rightNodeIndex == y.rightNodeIndex &&
+                                   x.objectIndex == y.objectIndex && x.objectCount == y.objectCount; });
+    }
+
+    // Prints build times of the median split builder, the lbvh builder and of the SAH builder with 1, 2, 4... threads,
+    // and checks that the parallel SAH builder gives the same tree as the single threaded one.
+    inline void compareBuilders(const std::vector<Object0> &srcObjects, BuildOptions options)
+    {
+        auto timeBuild = [&](const BuildOptions &buildOptions, std::vector<GpuModel::BvhNode> &nodes)
+        {
+            std::vector<Object0> orderedObjects;
+            auto start = std::chrono::high_resolution_clock::now();
+            nodes = build(srcObjects, orderedObjects, buildOptions);
+            auto end = std::chrono::high_resolution_clock::now();
+            return std::chrono::duration<double, std::milli>(end - start).count();
+        };
+
+        std::vector<GpuModel::BvhNode> nodes;
+        options.builder = BuilderType::RandomMedian;
+        std::cout << "Bvh build, " << srcObjects.size() << " objects\n";
+        std::cout << "  median split: " << timeBuild(options, nodes) << " ms, SAH cost " << sahCost(nodes, options) << "\n";
+        options.builder = BuilderType::Lbvh;
+        std::cout << "  lbvh: " << timeBuild(options, nodes) << " ms, SAH cost " << sahCost(nodes, options) << "\n";
+
+        std::vector<GpuModel::BvhNode> reference;
+        options.builder = BuilderType::BinnedSah;
+        unsigned maxThreads = std::max(std::thread::hardware_concurrency(), 1u);
+        for (unsigned threads = 1; threads <= maxThreads; threads *= 2)
+        {
+            options.buildThreads = threads;
+            double ms = timeBuild(options, nodes);
+            if (threads == 1)
+            {
+                reference = nodes;
+            }
+            std::cout << "  SAH, " << threads << " threads: " << ms << " ms, SAH cost " << sahCost(nodes, options)
+                      << (sameNodes(nodes, reference) ? "" : " (tree differs from single threaded build!)") << "\n";
+        }
+    }
 }
@@ -37,12 +37,43 @@ namespace GpuModel
         alignas(4) uint materialIndex;
     };
 
+    // Triangles as they are stored on GPU: 3 indices per triangle into a shared vertex buffer.
+    // Materials are a separate stream, only needed for the closest hit and not for every intersection test.
+    struct IndexedTriangles
+    {
+        // Positions of the vertices, w is unused.
+        std::vector<glm::vec4> vertices;
+        std::vector<uint> indices;
+        std::vector<uint> materialIndices;
+    };
+
+    // Triangle as the affine transform of Woop et al. into a space where it is the unit triangle.
+    // The ray is intersected with the plane z = 0 there, the hit is inside if u >= 0, v >= 0 and u + v <= 1.
+    // Rows are z, u and v, w holds the translation.
+    struct WoopTriangle
+    {
+        alignas(16) glm::vec4 rows[3];
+    };
+
     struct Sphere
     {
         alignas(16) glm::vec4 s;
         alignas(4) uint materialIndex;
     };
 
+    // Type of the primitives referenced by a bvh leaf. Leaves only hold primitives of one type.
+    enum PrimitiveType
+    {
+        TrianglePrimitive,
+        SpherePrimitive,
+        // Instance of a mesh with its own bvh, only in the top level bvh.
+        InstancePrimitive
+    };
+
+    // Leaf counts of the GPU nodes hold the number of primitives in the low bits and their PrimitiveType above this bit.
+    const int PrimitiveTypeShift = 28;
+    const int PrimitiveCountMask = (1 << PrimitiveTypeShift) - 1;
+
     // Node in a non recursive BHV for use on GPU.
     struct BvhNode
     {
@@ -50,9 +81,103 @@ namespace GpuModel
         alignas(16) glm::vec3 max;
         alignas(4) int leftNodeIndex = -1;
         alignas(4) int rightNodeIndex = -1;
+        // Leaves reference objectCount primitives starting at objectIndex.
         alignas(4) int objectIndex = -1;
+        alignas(4) int objectCount = 0;
+        // PrimitiveType of the leaf, objectIndex is an index in the array of this type.
+        alignas(4) int objectType = TrianglePrimitive;
+    };
+
+    // Compact 32 byte node of a bvh in depth-first order, as used on GPU.
+    // The left child of an inner node is the next node, so only the right child is stored.
+    struct CompactBvhNode
+    {
+        alignas(16) glm::vec3 min;
+        // Inner node: index of the right child. Leaf: index of the first primitive.
+        alignas(4) int offset = 0;
+        alignas(16) glm::vec3 max;
+        // Number and type of primitives in a leaf, see PrimitiveTypeShift. 0 for inner nodes.
+        alignas(4) int count = 0;
+    };
+
+    // Instance of an InstancedMesh, referenced by leaves of the top level bvh.
+    struct Instance
+    {
+        // Rows of the 3x4 transform from object space of the mesh into world space, and of its inverse.
+        alignas(16) glm::vec4 objectToWorld[3];
+        alignas(16) glm::vec4 worldToObject[3];
+        // Index of the root of the mesh bvh in the bvh buffer, set when the bvh is uploaded.
+        alignas(4) int blasRoot = 0;
+        alignas(4) uint meshIndex = 0;
     };
 
+    // Mesh with its own bottom level bvh in object space, placed in the scene by instances.
+    struct InstancedMesh
+    {
+        // Triangles in the order of the bvh leaves.
+        std::vector<Triangle> triangles;
+        std::vector<CompactBvhNode> bvhNodes;
+    };
+
+    // Marks a leaf in the last word of a QuantizedBvhNode.
+    const uint QuantizedLeaf = 0xFFFFFFFF;
+
+    // 16 byte bvh node for big scenes, in the same depth-first order as CompactBvhNode.
+    // A node doesn't store its own box. Inner nodes store the boxes of both children as 8 bit offsets
+    // relative to their own box, which the traversal already decoded from the parent. The root box is stored separately.
+    struct QuantizedBvhNode
+    {
+        // Inner node: child boxes, bytes are left min xyz, left max xyz, right min xyz, right max xyz.
+        // Leaf: index of the first primitive and the packed count of CompactBvhNode in data[0] and data[1].
+        alignas(4) uint data[3] = {0, 0, 0};
+        // Inner node: index of the right child. Leaf: QuantizedLeaf.
+        alignas(4) uint rightNodeIndex = QuantizedLeaf;
+    };
+
+    // Number of children of a WideBvhNode, one per vec4 lane in the shader.
+    const int BvhWidth = 4;
+
+    // 128 byte node of a 4-wide bvh. Child boxes are stored per axis, so the shader tests all of them with vec4 operations.
+    // Children are placed after their parent.
+    struct WideBvhNode
+    {
+        alignas(16) glm::vec4 minX;
+        alignas(16) glm::vec4 minY;
+        alignas(16) glm::vec4 minZ;
+        alignas(16) glm::vec4 maxX;
+        alignas(16) glm::vec4 maxY;
+        alignas(16) glm::vec4 maxZ;
+        // Inner child: index of the child node. Leaf child: index of the first primitive.
+        alignas(16) int child[BvhWidth] = {-1, -1, -1, -1};
+        // Packed count of a leaf child like in CompactBvhNode, 0 for inner children and -1 for empty slots.
+        alignas(16) int count[BvhWidth] = {-1, -1, -1, -1};
+    };
+
+    // Bvh traversal statistics written by the ray tracing shader when compiled with countBvhStats.
+    struct BvhStats
+    {
+        alignas(4) uint nodesVisited = 0;
+        alignas(4) uint raysTraced = 0;
+        alignas(4) uint trianglesTested = 0;
+        // Paths ended by hitting a light, by missing the scene and by reaching the maximum number of bounces.
+        // Only counted by the shader counters build, see SHADER_COUNTERS in main.cpp.
+        alignas(4) uint lightTerminations = 0;
+        alignas(4) uint missTerminations = 0;
+        alignas(4) uint maxBounceTerminations = 0;
+    };
+
+    enum class BvhLayout
+    {
+        Compact,
+        Quantized,
+        Wide,
+        // Compact nodes with miss links for stackless traversal, see Bvh::rope.
+        Roped
+    };
+
+    // Largest traversal stack the shaders are specialized with, deeper bvhs are rejected when they are uploaded.
+    const int MaxBvhStackSize = 64;
+
     // Model of light used for importance sampling.
     struct Light
     {
@@ -1,9 +1,11 @@
 #pragma once
 
 #include <vector>
+#include <unordered_map>
 #include <iostream>
 #include "GpuModels.h"
 #include "Bvh.h"
+#include "SceneCache.h"
 #include "../utils/glm.h"
 #include "../scene/Mesh.h"
 #include "../utils/RootDir.h"
@@ -29,19 +31,93 @@ namespace GpuModel
         return triangles;
     }
 
+    // Inverse of the matrix with columns v0 - v2, v1 - v2, n and translation v2, where n is the triangle normal.
+    // Degenerate triangles get zero rows and are never hit.
+    WoopTriangle getWoopTriangle(const Triangle &t)
+    {
+        glm::vec3 e0 = t.v0 - t.v2;
+        glm::vec3 e1 = t.v1 - t.v2;
+        glm::vec3 n = glm::cross(e0, e1);
+        float det = glm::dot(n, n);
+
+        WoopTriangle woop{};
+        if (det == 0.0f)
+        {
+            return woop;
+        }
+        glm::vec3 rows[3] = {n / det, glm::cross(e1, n) / det, glm::cross(n, e0) / det};
+        for (int i = 0; i < 3; i++)
+        {
+            woop.rows[i] = glm::vec4(rows[i], -glm::dot(rows[i], t.v2));
+        }
+        return woop;
+    }
+
     /*
      * The scene to be ray traced. All objects are split into triangles and put into a common triangle array.
+     * Triangles, spheres and instances share one bvh. Instances place meshes with their own bvh into the scene,
+     * so a mesh is stored once no matter how many times it appears.
      */
     struct Scene
     {
         // triangles contain all triangles from all objects in the scene.
+        // triangles, bvhNodes and meshes are the build data of the scene, only needed to change it. A scene loaded
+        // from the cache leaves them in the mapped file until loadBuildData, see cachedBuildData.
         std::vector<Triangle> triangles;
         std::vector<Sphere> spheres;
+        // Meshes referenced by instances, their triangles are stored after triangles on GPU, see gpuTriangles.
+        std::vector<InstancedMesh> meshes;
+        std::vector<Instance> instances;
         std::vector<Material> materials;
         std::vector<Light> lights;
         std::vector<BvhNode> bvhNodes;
+        // Triangles as uploaded to the GPU, see indexedTriangles. Read in place from the mapped cache file
+        // when the scene was loaded from it, so they are streamed to the GPU straight from the file.
+        SceneCache::Array<glm::vec4> gpuVertices;
+        SceneCache::Array<uint> gpuIndices;
+        SceneCache::Array<uint> gpuMaterialIndices;
+        // bvhNodes in the compact layout used by the shaders, followed by the bvhs of meshes. Read in place like gpuVertices.
+        SceneCache::Array<CompactBvhNode> compactBvhNodes;
+        // bvhNodes in the quantized layout, only built with BvhLayout::Quantized.
+        std::vector<QuantizedBvhNode> quantizedBvhNodes;
+        // Box of the root node of the quantized bvh.
+        Bvh::Aabb quantizedBvhBox;
+        // bvhNodes collapsed into a 4-wide bvh, only built with BvhLayout::Wide.
+        std::vector<WideBvhNode> wideBvhNodes;
+        // compactBvhNodes with miss links, only built with BvhLayout::Roped.
+        std::vector<CompactBvhNode> ropedBvhNodes;
+        // Stack entries the shader needs to traverse the bvh in its GPU layout, the size of its stack arrays.
+        int bvhStackSize = 0;
+        // Index in compactBvhNodes and parent of every node of bvhNodes, to refit without packing the bvh again.
+        // Derived on the first refit after a build.
+        std::vector<int> compactNodeIndices;
+        std::vector<int> bvhParents;
+
+        // Build data of a scene loaded from the cache, read in place until loadBuildData copies it into the vectors.
+        struct CachedBuildData
+        {
+            SceneCache::Array<Triangle> triangles;
+            SceneCache::Array<BvhNode> bvhNodes;
+            std::vector<SceneCache::Array<Triangle>> meshTriangles;
+            std::vector<SceneCache::Array<CompactBvhNode>> meshBvhNodes;
+        };
+        CachedBuildData cachedBuildData;
+        bool buildDataLoaded = true;
 
-        Scene()
+        // Bvh builder and its SAH cost model.
+        Bvh::BuildOptions bvhOptions;
+        // Layout of the bvh on GPU. Quantized nodes take half the memory of compact ones, at the cost of decoding in the shader.
+        // Wide nodes test 4 child boxes per node fetch, which makes the tree shallower.
+        // Roped nodes are traversed without a stack, but always in the same order.
+        BvhLayout bvhLayout = BvhLayout::Compact;
+        // SAH cost of the bvh right after it was built.
+        float bvhBuildCost = 0.0f;
+        // updateBvh rebuilds the bvh once refitting made its SAH cost this much worse than after the build.
+        float bvhRebuildRatio = 1.5f;
+
+        // withInstances adds a row of small doges sharing one copy of the mesh. Instances need the compact bvh layout,
+        // so the bvh benchmark measures the instance traversal on its own scene.
+        explicit Scene(bool withInstances = false)
         {
             const std::string path_prefix = std::string(ROOT_DIR) + "resources/";
 
@@ -59,45 +135,596 @@ namespace GpuModel
             materials.push_back(metal);
             materials.push_back(glass);
 
+            spheres.push_back({glm::vec4(0.6, 1, -1, 0.6), 5});
+
+            // Models of the scene and their materials, their triangles are added in this order.
+            const std::string modelDir = path_prefix + "/models/doge_scene/";
+            const std::vector<std::pair<std::string, uint>> models = {
+                {"buff-doge.obj", 0},
+                //{"box1.obj", 4},
+                {"cheems.obj", 0},
+                //{"box2.obj", 0},
+                {"right.obj", 1},
+                {"left.obj", 2},
+                {"back.obj", 0},
+                {"ceil.obj", 0},
+                {"floor.obj", 0},
+                {"light.obj", 3}};
+
+            // Models shared by instances and the instances placing them into the scene, by index in meshModels and transform.
+            // They are part of the cache key like models, so instances have to be added here and not after the cache is loaded.
+            std::vector<std::pair<std::string, uint>> meshModels;
+            std::vector<std::pair<uint, glm::mat4>> meshInstances;
+
+            if (withInstances)
+            {
+                meshModels.push_back({"buff-doge.obj", 0});
+                for (int i = 0; i < 4; i++)
+                {
+                    glm::mat4 transform = glm::translate(glm::mat4(1.0f), glm::vec3(-1.5f + i, 0.0f, 1.0f));
+                    meshInstances.push_back({0, glm::scale(transform, glm::vec3(0.3f))});
+                }
+            }
+
+            // The cache is keyed by the contents of the models and everything else the scene is built from.
+            // Changes to how the scene is put together below need a new SceneCache::Version.
+            SceneCache::Hash key;
+            for (auto &model : models)
+            {
+                key.addFile(modelDir + model.first);
+                key.add(model.second);
+            }
+            // Counts keep a model from hashing the same when it moves between the lists.
+            key.add(uint64_t(meshModels.size()));
+            key.add(uint64_t(meshInstances.size()));
+            for (auto &model : meshModels)
+            {
+                key.addFile(modelDir + model.first);
+                key.add(model.second);
+            }
+            for (auto &instance : meshInstances)
+            {
+                key.add(instance.first);
+                key.add(&instance.second, sizeof(instance.second));
+            }
+            for (auto &material : materials)
+            {
+                key.add(material.type);
+                key.add(&material.albedo, sizeof(material.albedo));
+            }
+            for (auto &sphere : spheres)
+            {
+                key.add(&sphere.s, sizeof(sphere.s));
+                key.add(sphere.materialIndex);
+            }
+            key.add(bvhOptions.builder);
+            key.add(bvhOptions.sahBins);
+            key.add(bvhOptions.traversalCost);
+            key.add(bvhOptions.intersectionCost);
+            key.add(bvhOptions.maxLeafSize);
+
+            // Scenes with instances have their own file, so switching between the scenes doesn't rebuild both.
+            const std::string cachePath = path_prefix + (withInstances ? "scene-cache-instances.bin" : "scene-cache.bin");
+            if (loadCache(cachePath, key.value))
+            {
+                std::cout << "Scene: loaded " << gpuMaterialIndices.size() << " triangles and " << compactBvhNodes.size() << " bvh nodes from " << cachePath << "\n";
+                return;
+            }
+
+            for (auto &model : models)
+            {
+                std::vector<Triangle> modelTriangles = getTriangles(modelDir + model.first, model.second);
+                triangles.insert(triangles.end(), modelTriangles.begin(), modelTriangles.end());
+            }
+
+            for (auto &model : meshModels)
+            {
+                addMesh(getTriangles(modelDir + model.first, model.second));
+            }
+            for (auto &instance : meshInstances)
+            {
+                addInstance(instance.first, instance.second);
+            }
+
+            buildBvh();
+            if (!saveCache(cachePath, key.value))
+            {
+                std::cout << "Scene: failed to write " << cachePath << "\n";
+                return;
+            }
+            // Continue on the written cache, so the built arrays are freed and only the mapped file is kept.
+            loadCache(cachePath, key.value);
+        }
+
+        // Replaces the scene with a scene cached by saveCache under the same key, keeps it if there is none.
+        bool loadCache(const std::string &path, uint64_t key)
+        {
+            SceneCache::Reader reader(path, key);
+            if (!reader.valid())
+            {
+                return false;
+            }
+
+            // Read everything before touching the scene, so a truncated file leaves it unchanged.
+            // Small arrays are copied, big ones are read in place.
+            CachedBuildData cachedBuild;
+            std::vector<Sphere> cachedSpheres;
+            std::vector<Material> cachedMaterials;
+            std::vector<Light> cachedLights;
+            std::vector<Instance> cachedInstances;
+            SceneCache::Array<glm::vec4> cachedGpuVertices;
+            SceneCache::Array<uint> cachedGpuIndices;
+            SceneCache::Array<uint> cachedGpuMaterialIndices;
+            SceneCache::Array<CompactBvhNode> cachedCompactBvhNodes;
+            float cachedBvhBuildCost = 0.0f;
+            uint64_t meshCount = 0;
+            bool complete = reader.read(cachedBuild.triangles) && reader.read(cachedSpheres) && reader.read(cachedMaterials) &&
+                            reader.read(cachedLights) && reader.read(cachedBuild.bvhNodes) && reader.read(cachedInstances) &&
+                            reader.readValue(cachedBvhBuildCost) && reader.readValue(meshCount);
+            for (uint64_t i = 0; complete && i < meshCount; i++)
+            {
+                cachedBuild.meshTriangles.emplace_back();
+                cachedBuild.meshBvhNodes.emplace_back();
+                complete = reader.read(cachedBuild.meshTriangles.back()) && reader.read(cachedBuild.meshBvhNodes.back());
+            }
+            complete = complete && reader.read(cachedGpuVertices) && reader.read(cachedGpuIndices) &&
+                       reader.read(cachedGpuMaterialIndices) && reader.read(cachedCompactBvhNodes);
+            if (!complete)
+            {
+                return false;
+            }
+
+            // Assigning empty vectors frees the build data of a scene that was just built.
+            triangles = std::vector<Triangle>();
+            bvhNodes = std::vector<BvhNode>();
+            meshes = std::vector<InstancedMesh>();
+            cachedBuildData = std::move(cachedBuild);
+            buildDataLoaded = false;
+            spheres = std::move(cachedSpheres);
+            materials = std::move(cachedMaterials);
+            lights = std::move(cachedLights);
+            instances = std::move(cachedInstances);
+            gpuVertices = cachedGpuVertices;
+            gpuIndices = cachedGpuIndices;
+            gpuMaterialIndices = cachedGpuMaterialIndices;
+            compactBvhNodes = cachedCompactBvhNodes;
+            compactNodeIndices.clear();
+            bvhParents.clear();
+            bvhBuildCost = cachedBvhBuildCost;
+            updateBvhLayout();
+            return true;
+        }
+
+        // Writes the built scene to a cache file. The GPU triangles and the compact bvh are cached as they are uploaded,
+        // other layouts of the bvh are quick to derive from the compact one.
+        bool saveCache(const std::string &path, uint64_t key)
+        {
+            loadBuildData();
+            SceneCache::Writer writer(path, key);
+            writer.write(triangles);
+            writer.write(spheres);
+            writer.write(materials);
+            writer.write(lights);
+            writer.write(bvhNodes);
+            writer.write(instances);
+            writer.writeValue(bvhBuildCost);
+            writer.writeValue(uint64_t(meshes.size()));
+            for (auto &mesh : meshes)
+            {
+                writer.write(mesh.triangles);
+                writer.write(mesh.bvhNodes);
+            }
+            writer.write(gpuVertices);
+            writer.write(gpuIndices);
+            writer.write(gpuMaterialIndices);
+            writer.write(compactBvhNodes);
+            return writer.finish();
+        }
+
+        // Copies the build data of a scene loaded from the cache out of the mapped file. Everything that changes
+        // the scene calls it first.
+        void loadBuildData()
+        {
+            if (buildDataLoaded)
+            {
+                return;
+            }
+            triangles.assign(cachedBuildData.triangles.begin(), cachedBuildData.triangles.end());
+            bvhNodes.assign(cachedBuildData.bvhNodes.begin(), cachedBuildData.bvhNodes.end());
+            meshes.clear();
+            for (size_t i = 0; i < cachedBuildData.meshTriangles.size(); i++)
+            {
+                InstancedMesh mesh;
+                mesh.triangles.assign(cachedBuildData.meshTriangles[i].begin(), cachedBuildData.meshTriangles[i].end());
+                mesh.bvhNodes.assign(cachedBuildData.meshBvhNodes[i].begin(), cachedBuildData.meshBvhNodes[i].end());
+                meshes.push_back(mesh);
+            }
+            cachedBuildData = CachedBuildData();
+            buildDataLoaded = true;
+        }
+
+        // Number of triangles of the scene without the triangles of meshes, also when the build data isn't loaded.
+        size_t sceneTriangleCount() const
+        {
+            return buildDataLoaded ? triangles.size() : cachedBuildData.triangles.size();
+        }
+
+        // Frees the GPU triangle arrays once they are uploaded. They are derived again when the scene changes.
+        void releaseGpuTriangles()
+        {
+            gpuVertices = SceneCache::Array<glm::vec4>();
+            gpuIndices = SceneCache::Array<uint>();
+            gpuMaterialIndices = SceneCache::Array<uint>();
+        }
+
+        // Builds a bvh over triangles in object space, to be placed into the scene by addInstance.
+        // Returns the index of the mesh.
+        uint addMesh(const std::vector<Triangle> &meshTriangles)
+        {
+            loadBuildData();
             std::vector<Bvh::Object0> objects;
+            for (uint32_t i = 0; i < meshTriangles.size(); i++)
+            {
+                objects.push_back({i, meshTriangles[i]});
+            }
 
-            std::vector<Triangle> floorTriangles = getTriangles(path_prefix + "/models/doge_scene/floor.obj", 0);
+            InstancedMesh mesh;
+            std::vector<Bvh::Object0> orderedObjects;
+            std::vector<BvhNode> nodes = Bvh::build(objects, orderedObjects, bvhOptions);
+            mesh.bvhNodes = Bvh::compact(nodes);
+            for (auto &object : orderedObjects)
+            {
+                mesh.triangles.push_back(object.t);
+            }
+            meshes.push_back(mesh);
+            return meshes.size() - 1;
+        }
 
-            std::vector<Triangle> dogeTriangles = getTriangles(path_prefix + "/models/doge_scene/buff-doge.obj", 0);
-            //std::vector<Triangle> dogeTriangles = getTriangles(path_prefix + "/models/doge_scene/box1.obj", 4);
+        // Places a mesh into the scene. Takes effect on the next buildBvh, setInstanceTransform moves it afterwards.
+        void addInstance(uint meshIndex, const glm::mat4 &objectToWorld)
+        {
+            loadBuildData();
+            if (meshIndex >= meshes.size())
+            {
+                throw std::runtime_error("instance of an unknown mesh!");
+            }
+            Instance instance;
+            Bvh::transformRows(objectToWorld, instance.objectToWorld);
+            Bvh::transformRows(glm::inverse(objectToWorld), instance.worldToObject);
+            instance.meshIndex = meshIndex;
+            instances.push_back(instance);
+        }
 
-            //std::vector<Triangle> cheemsTriangles = getTriangles(path_prefix + "/models/doge_scene/box2.obj", 0);
-            std::vector<Triangle> cheemsTriangles = getTriangles(path_prefix + "/models/doge_scene/cheems.obj", 0);
+        // Triangles as stored on GPU: the triangles of the scene followed by the triangles of all meshes.
+        // Like indexedTriangles and instanceBoxes, it reads the build data, see loadBuildData.
+        std::vector<Triangle> gpuTriangles() const
+        {
+            std::vector<Triangle> result = triangles;
+            for (auto &mesh : meshes)
+            {
+                result.insert(result.end(), mesh.triangles.begin(), mesh.triangles.end());
+            }
+            return result;
+        }
+
+        // gpuTriangles with shared vertices. Vertices are shared by position, so vertices that were only
+        // split for different normals or texture coordinates in the mesh are merged too.
+        IndexedTriangles indexedTriangles() const
+        {
+            IndexedTriangles result;
+            std::unordered_map<glm::vec3, uint> vertexIndices;
+            for (const Triangle &t : gpuTriangles())
+            {
+                for (const glm::vec3 &v : {t.v0, t.v1, t.v2})
+                {
+                    auto inserted = vertexIndices.insert({v, (uint)result.vertices.size()});
+                    if (inserted.second)
+                    {
+                        result.vertices.push_back(glm::vec4(v, 1.0f));
+                    }
+                    result.indices.push_back(inserted.first->second);
+                }
+                result.materialIndices.push_back(t.materialIndex);
+            }
+            return result;
+        }
 
-            std::vector<Triangle> rightWallTriangles = getTriangles(path_prefix + "/models/doge_scene/right.obj", 1);
-            std::vector<Triangle> leftWallTriangles = getTriangles(path_prefix + "/models/doge_scene/left.obj", 2);
-            std::vector<Triangle> backWallTriangles = getTriangles(path_prefix + "/models/doge_scene/back.obj", 0);
-            std::vector<Triangle> ceilTriangles = getTriangles(path_prefix + "/models/doge_scene/ceil.obj", 0);
-            std::vector<Triangle> lightTriangles = getTriangles(path_prefix + "/models/doge_scene/light.obj", 3);
+        // GPU triangles precomputed for the intersection test, they take 48 bytes per triangle.
+        // Built from the GPU arrays, so it works without the build data.
+        std::vector<WoopTriangle> woopTriangles() const
+        {
+            std::vector<WoopTriangle> result;
+            for (size_t i = 0; i < gpuMaterialIndices.size(); i++)
+            {
+                Triangle t{glm::vec3(gpuVertices[gpuIndices[3 * i]]), glm::vec3(gpuVertices[gpuIndices[3 * i + 1]]),
+                           glm::vec3(gpuVertices[gpuIndices[3 * i + 2]]), gpuMaterialIndices[i]};
+                result.push_back(getWoopTriangle(t));
+            }
+            return result;
+        }
 
-            triangles.insert(triangles.end(), dogeTriangles.begin(), dogeTriangles.end());
-            triangles.insert(triangles.end(), cheemsTriangles.begin(), cheemsTriangles.end());
-            triangles.insert(triangles.end(), rightWallTriangles.begin(), rightWallTriangles.end());
-            triangles.insert(triangles.end(), leftWallTriangles.begin(), leftWallTriangles.end());
-            triangles.insert(triangles.end(), backWallTriangles.begin(), backWallTriangles.end());
-            triangles.insert(triangles.end(), ceilTriangles.begin(), ceilTriangles.end());
-            triangles.insert(triangles.end(), floorTriangles.begin(), floorTriangles.end());
-            triangles.insert(triangles.end(), lightTriangles.begin(), lightTriangles.end());
+        // World boxes of the instances, in the order of instances.
+        std::vector<Bvh::Aabb> instanceBoxes() const
+        {
+            std::vector<Bvh::Aabb> boxes;
+            for (auto &instance : instances)
+            {
+                const CompactBvhNode &root = meshes[instance.meshIndex].bvhNodes[0];
+                boxes.push_back(Bvh::instanceBoundingBox(instance, {root.min, root.max}));
+            }
+            return boxes;
+        }
 
+        // Objects the bvh is built over: triangles, spheres and the world boxes of instances.
+        // Reads the build data like instanceBoxes.
+        std::vector<Bvh::Object0> bvhObjects() const
+        {
+            std::vector<Bvh::Object0> objects;
             for (uint32_t i = 0; i < triangles.size(); i++)
             {
-                Triangle t = triangles[i];
-                objects.push_back({i, t});
+                objects.push_back({i, triangles[i]});
+            }
+            for (uint32_t i = 0; i < spheres.size(); i++)
+            {
+                objects.push_back({i, {}, SpherePrimitive, spheres[i]});
+            }
+            std::vector<Bvh::Aabb> boxes = instanceBoxes();
+            for (uint32_t i = 0; i < instances.size(); i++)
+            {
+                objects.push_back({i, {}, InstancePrimitive, {}, boxes[i]});
+            }
+            return objects;
+        }
+
+        // Builds the bvh over the current triangles, spheres and instances and reorders them to match its leaves.
+        void buildBvh()
+        {
+            loadBuildData();
+            std::vector<Bvh::Object0> objects = bvhObjects();
+
+            // Bvh leaves reference ranges of triangles, spheres or instances, so all are stored in the order of the leaves.
+            std::vector<Bvh::Object0> orderedObjects;
+            bvhNodes = Bvh::build(objects, orderedObjects, bvhOptions);
+            Bvh::splitPrimitiveTypes(bvhNodes, orderedObjects);
+            bvhBuildCost = Bvh::sahCost(bvhNodes, bvhOptions);
+            std::cout << "Bvh: " << bvhNodes.size() << " nodes, SAH cost " << bvhBuildCost << "\n";
+
+            std::vector<Instance> unorderedInstances = instances;
+            triangles.clear();
+            spheres.clear();
+            instances.clear();
+            lights.clear();
+            for (auto &object : orderedObjects)
+            {
+                if (object.type == SpherePrimitive)
+                {
+                    spheres.push_back(object.s);
+                    continue;
+                }
+                if (object.type == InstancePrimitive)
+                {
+                    instances.push_back(unorderedInstances[object.index]);
+                    continue;
+                }
+
+                Triangle t = object.t;
                 if (materials[t.materialIndex].type == MaterialType::LightSource)
                 {
                     float area = glm::length(glm::cross(t.v0, t.v1)) * 0.5f;
-                    lights.push_back({i, area});
+                    lights.push_back({(uint)triangles.size(), area});
                 }
+                triangles.push_back(t);
             }
+            updateGpuTriangles();
+            // Mesh bvhs reference triangles after the scene triangles, so they are appended once the scene triangles are known.
+            updateGpuBvh();
+        }
 
-            spheres.push_back({glm::vec4(0.6, 1, -1, 0.6), 5});
+        // Converts triangles and the triangles of meshes into the GPU arrays.
+        void updateGpuTriangles()
+        {
+            IndexedTriangles indexed = indexedTriangles();
+            gpuVertices = SceneCache::Array<glm::vec4>(std::move(indexed.vertices));
+            gpuIndices = SceneCache::Array<uint>(std::move(indexed.indices));
+            gpuMaterialIndices = SceneCache::Array<uint>(std::move(indexed.materialIndices));
+        }
+
+        // Converts bvhNodes into the GPU layout.
+        void updateGpuBvh()
+        {
+            std::vector<CompactBvhNode> nodes = Bvh::compact(bvhNodes, &compactNodeIndices);
+            bvhParents.clear();
+            if (!instances.empty())
+            {
+                appendMeshBvhs(nodes);
+            }
+            compactBvhNodes = SceneCache::Array<CompactBvhNode>(std::move(nodes));
+            updateBvhLayout();
+        }
+
+        // Derives the bvh in bvhLayout from compactBvhNodes, enough when only the layout changed.
+        void updateBvhLayout()
+        {
+            if (!instances.empty() && bvhLayout != BvhLayout::Compact)
+            {
+                throw std::runtime_error("instances need the compact bvh layout!");
+            }
+
+            // Other layouts are built from a copy, compactBvhNodes may be read in place from the cache.
+            if (bvhLayout != BvhLayout::Compact)
+            {
+                std::vector<CompactBvhNode> nodes(compactBvhNodes.begin(), compactBvhNodes.end());
+                if (bvhLayout == BvhLayout::Quantized)
+                {
+                    quantizedBvhNodes = Bvh::quantize(nodes, quantizedBvhBox);
+                }
+                else if (bvhLayout == BvhLayout::Wide)
+                {
+                    wideBvhNodes = Bvh::collapse(nodes);
+                }
+                else if (bvhLayout == BvhLayout::Roped)
+                {
+                    ropedBvhNodes = Bvh::rope(nodes);
+                }
+            }
+
+            // Quantized nodes keep the order of the compact ones. Roped traversal has no stack, but the
+            // stack traversal is compiled into the same shader.
+            if (bvhLayout == BvhLayout::Wide)
+            {
+                bvhStackSize = Bvh::wideStackSize(wideBvhNodes);
+            }
+            else
+            {
+                // Mesh bvhs are traversed from the roots of the instances in compactBvhNodes, once per mesh.
+                std::unordered_map<int, int> meshStackSizes;
+                std::vector<int> instanceStackSizes;
+                for (auto &instance : instances)
+                {
+                    auto inserted = meshStackSizes.insert({instance.blasRoot, 0});
+                    if (inserted.second)
+                    {
+                        inserted.first->second = Bvh::stackSize(compactBvhNodes, instance.blasRoot);
+                    }
+                    instanceStackSizes.push_back(inserted.first->second);
+                }
+                bvhStackSize = Bvh::stackSize(compactBvhNodes, 0, instanceStackSizes);
+            }
+            if (bvhStackSize > MaxBvhStackSize)
+            {
+                throw std::runtime_error("bvh is too deep for the traversal stack of the shaders!");
+            }
+            bvhStackSize = std::max(bvhStackSize, 1);
+        }
+
+        // Appends the bvhs of all meshes to the compact nodes and points the instances at their roots.
+        void appendMeshBvhs(std::vector<CompactBvhNode> &compactNodes)
+        {
+            std::vector<int> meshRoots;
+            int triangleOffset = triangles.size();
+            for (auto &mesh : meshes)
+            {
+                int nodeOffset = compactNodes.size();
+                meshRoots.push_back(nodeOffset);
+                for (CompactBvhNode node : mesh.bvhNodes)
+                {
+                    // Inner nodes reference their right child, leaves their first triangle.
+                    node.offset += node.count == 0 ? nodeOffset : triangleOffset;
+                    compactNodes.push_back(node);
+                }
+                triangleOffset += mesh.triangles.size();
+            }
+
+            for (auto &instance : instances)
+            {
+                instance.blasRoot = meshRoots[instance.meshIndex];
+            }
+        }
+
+        // Copies the boxes of bvhNodes into compactBvhNodes after a refit, the nodes keep their order and links.
+        void updateGpuBvhBoxes()
+        {
+            if (compactNodeIndices.size() != bvhNodes.size())
+            {
+                Bvh::compact(bvhNodes, &compactNodeIndices);
+            }
+            std::vector<CompactBvhNode> nodes(compactBvhNodes.begin(), compactBvhNodes.end());
+            for (size_t i = 0; i < bvhNodes.size(); i++)
+            {
+                nodes[compactNodeIndices[i]].min = bvhNodes[i].min;
+                nodes[compactNodeIndices[i]].max = bvhNodes[i].max;
+            }
+            compactBvhNodes = SceneCache::Array<CompactBvhNode>(std::move(nodes));
+            // The other layouts are derived from the compact nodes again.
+            if (bvhLayout != BvhLayout::Compact)
+            {
+                updateBvhLayout();
+            }
+        }
+
+        // Moves the instance at instanceIndex in instances, which are in the order of the bvh leaves after buildBvh.
+        // Only the top level nodes above the instance are refit, the bvhs of meshes and the triangles stay as they are.
+        // The top level degrades as instances move away from where it was built, buildBvh rebuilds it.
+        // instances and compactBvhNodes have to be uploaded again.
+        void setInstanceTransform(uint instanceIndex, const glm::mat4 &objectToWorld)
+        {
+            loadBuildData();
+            if (instanceIndex >= instances.size())
+            {
+                throw std::runtime_error("transform of an unknown instance!");
+            }
+            Instance &instance = instances[instanceIndex];
+            Bvh::transformRows(objectToWorld, instance.objectToWorld);
+            Bvh::transformRows(glm::inverse(objectToWorld), instance.worldToObject);
 
-            bvhNodes = Bvh::createBvh(objects);
+            if (bvhParents.size() != bvhNodes.size())
+            {
+                bvhParents = Bvh::parentIndices(bvhNodes);
+            }
+            for (size_t i = 0; i < bvhNodes.size(); i++)
+            {
+                const BvhNode &node = bvhNodes[i];
+                if (node.leftNodeIndex == -1 && node.objectType == InstancePrimitive && node.objectIndex <= int(instanceIndex) &&
+                    int(instanceIndex) < node.objectIndex + node.objectCount)
+                {
+                    Bvh::refitLeaf(bvhNodes, bvhParents, i, triangles, spheres, instanceBoxes());
+                    break;
+                }
+            }
+            updateGpuBvhBoxes();
+        }
+
+        // Moves every vertex of the scene triangles to move(vertex) and writes the new positions into the GPU vertices,
+        // which keep their order and indices. GPU vertices are shared by position, so move has to depend on the position only.
+        // The bvh is refit or rebuilt afterwards, see updateBvh.
+        template <typename Move>
+        void moveVertices(const Move &move)
+        {
+            loadBuildData();
+            for (Triangle &t : triangles)
+            {
+                t.v0 = move(t.v0);
+                t.v1 = move(t.v1);
+                t.v2 = move(t.v2);
+            }
+            // Released GPU triangles are derived again.
+            if (gpuIndices.size() == 0)
+            {
+                updateGpuTriangles();
+                return;
+            }
+            std::vector<glm::vec4> vertices(gpuVertices.begin(), gpuVertices.end());
+            for (size_t i = 0; i < triangles.size(); i++)
+            {
+                vertices[gpuIndices[3 * i]] = glm::vec4(triangles[i].v0, 1.0f);
+                vertices[gpuIndices[3 * i + 1]] = glm::vec4(triangles[i].v1, 1.0f);
+                vertices[gpuIndices[3 * i + 2]] = glm::vec4(triangles[i].v2, 1.0f);
+            }
+            gpuVertices = SceneCache::Array<glm::vec4>(std::move(vertices));
+        }
+
+        // Refits the bvh to triangles, spheres and instances that moved since it was built, the topology stays the same.
+        // Only the node boxes change, so only the bvh has to be uploaded again.
+        // Returns the SAH cost relative to the cost right after the last build: the tree degrades
+        // as triangles move away from where it was built.
+        float refitBvh()
+        {
+            loadBuildData();
+            Bvh::refit(bvhNodes, triangles, spheres, instanceBoxes());
+            updateGpuBvhBoxes();
+            return Bvh::sahCost(bvhNodes, bvhOptions) / bvhBuildCost;
+        }
+
+        // Refits the bvh, or rebuilds it when refitting made it too slow to traverse.
+        // Returns true if the bvh was rebuilt, in this case triangles and spheres were reordered and lights changed too.
+        bool updateBvh()
+        {
+            if (refitBvh() <= bvhRebuildRatio)
+            {
+                return false;
+            }
+            buildBvh();
+            return true;
         }
     };
 }
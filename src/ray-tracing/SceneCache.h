@@ -0,0 +1,348 @@
+#pragma once
+
+#include <string>
+#include <vector>
+#include <fstream>
+#include <iostream>
+#include <cstdio>
+#include <cstring>
+#include <memory>
+#include <type_traits>
+#include <stdint.h>
+#ifdef _WIN32
+#ifndef NOMINMAX
+#define NOMINMAX
+#endif
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#endif
+
+/*
+ * Binary cache of a built scene, so the scene is not parsed from OBJ files and its bvh is not built on every start.
+ * The file starts with a header holding the version and the key of the sources the scene was built from,
+ * followed by arrays stored as their element count and the raw elements. Elements start at a multiple of ArrayAlignment,
+ * so arrays can be used in place in the mapped file.
+ */
+namespace SceneCache
+{
+    // Bump when the file layout, a cached struct or the way the scene is put together changes.
+    const uint32_t Version = 2;
+    const uint32_t Magic = 0x43535452;
+    // Alignment of the elements of every array in the file, enough for the vec4 members of the GPU structs.
+    const size_t ArrayAlignment = 16;
+
+    inline size_t alignArray(size_t position)
+    {
+        return (position + ArrayAlignment - 1) / ArrayAlignment * ArrayAlignment;
+    }
+
+    // Immutable array, either read in place from a mapped cache file or owning its elements.
+    // Copies share the elements, a mapped file stays mapped as long as an array in it exists.
+    template <typename T>
+    class Array
+    {
+    public:
+        Array() = default;
+
+        explicit Array(std::vector<T> values)
+        {
+            auto owned = std::make_shared<const std::vector<T>>(std::move(values));
+            m_data = owned->data();
+            m_size = owned->size();
+            m_owner = owned;
+        }
+
+        Array(std::shared_ptr<const void> owner, const T *data, size_t size) : m_owner(owner), m_data(data), m_size(size) {}
+
+        const T *data() const { return m_data; }
+        size_t size() const { return m_size; }
+        bool empty() const { return m_size == 0; }
+        const T *begin() const { return m_data; }
+        const T *end() const { return m_data + m_size; }
+        const T &operator[](size_t i) const { return m_data[i]; }
+
+    private:
+        std::shared_ptr<const void> m_owner;
+        const T *m_data = nullptr;
+        size_t m_size = 0;
+    };
+
+    struct Header
+    {
+        uint32_t magic = Magic;
+        uint32_t version = Version;
+        uint64_t key = 0;
+    };
+
+    // 64 bit FNV-1a hash of everything a cached scene was built from.
+    struct Hash
+    {
+        uint64_t value = 14695981039346656037ull;
+
+        void add(const void *data, size_t size)
+        {
+            const unsigned char *bytes = static_cast<const unsigned char *>(data);
+            for (size_t i = 0; i < size; i++)
+            {
+                value = (value ^ bytes[i]) * 1099511628211ull;
+            }
+        }
+
+        // Only for types without padding, padding bytes are not initialized.
+        template <typename T>
+        void add(const T &value)
+        {
+            static_assert(std::is_arithmetic<T>::value || std::is_enum<T>::value, "hash the fields of structs one by one");
+            add(&value, sizeof(T));
+        }
+
+        void addFile(const std::string &path)
+        {
+            std::ifstream file(path, std::ios::binary);
+            if (!file.is_open())
+            {
+                throw std::runtime_error("failed to open " + path);
+            }
+            std::vector<char> contents((std::istreambuf_iterator<char>(file)), std::istreambuf_iterator<char>());
+            add(contents.size());
+            add(contents.data(), contents.size());
+        }
+    };
+
+    // Writes a cache file. The file is written under a temporary name and renamed when complete,
+    // so an interrupted write never leaves a cache that looks valid.
+    class Writer
+    {
+    public:
+        Writer(const std::string &path, uint64_t key) : m_path(path), m_file(path + ".tmp", std::ios::binary)
+        {
+            Header header;
+            header.key = key;
+            writeValue(header);
+        }
+
+        template <typename T>
+        void write(const T *values, uint64_t count)
+        {
+            static_assert(std::is_trivially_copyable<T>::value, "only trivially copyable types can be cached");
+            static_assert(alignof(T) <= ArrayAlignment, "cached arrays are aligned to ArrayAlignment");
+            writeValue(count);
+            const char padding[ArrayAlignment] = {};
+            writeBytes(padding, alignArray(m_position) - m_position);
+            writeBytes(values, count * sizeof(T));
+        }
+
+        template <typename T>
+        void write(const std::vector<T> &values)
+        {
+            write(values.data(), values.size());
+        }
+
+        template <typename T>
+        void write(const Array<T> &values)
+        {
+            write(values.data(), values.size());
+        }
+
+        template <typename T>
+        void writeValue(const T &value)
+        {
+            static_assert(std::is_trivially_copyable<T>::value, "only trivially copyable types can be cached");
+            writeBytes(&value, sizeof(T));
+        }
+
+        // Returns false if the cache could not be written, e.g. in a read-only directory.
+        bool finish()
+        {
+            m_file.close();
+            std::string tmpPath = m_path + ".tmp";
+            if (!m_file || !replaceFile(tmpPath, m_path))
+            {
+                std::remove(tmpPath.c_str());
+                return false;
+            }
+            return true;
+        }
+
+    private:
+        // std::rename doesn't replace an existing file on Windows.
+        static bool replaceFile(const std::string &from, const std::string &to)
+        {
+#ifdef _WIN32
+            return MoveFileExA(from.c_str(), to.c_str(), MOVEFILE_REPLACE_EXISTING) != 0;
+#else
+            return std::rename(from.c_str(), to.c_str()) == 0;
+#endif
+        }
+
+        void writeBytes(const void *data, size_t size)
+        {
+            m_file.write(static_cast<const char *>(data), size);
+            m_position += size;
+        }
+
+        std::string m_path;
+        std::ofstream m_file;
+        size_t m_position = 0;
+    };
+
+    // Maps a whole file read-only and sets size to its size. The file stays mapped as long as a copy of the result exists.
+    // Returns nullptr if the file can't be opened or mapped.
+    inline std::shared_ptr<const void> mapFile(const std::string &path, size_t &size)
+    {
+        size = 0;
+#ifdef _WIN32
+        HANDLE file = CreateFileA(path.c_str(), GENERIC_READ, FILE_SHARE_READ | FILE_SHARE_DELETE, nullptr, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, nullptr);
+        if (file == INVALID_HANDLE_VALUE)
+        {
+            return nullptr;
+        }
+        LARGE_INTEGER fileSize;
+        void *view = nullptr;
+        if (GetFileSizeEx(file, &fileSize) && fileSize.QuadPart > 0)
+        {
+            HANDLE mapping = CreateFileMappingA(file, nullptr, PAGE_READONLY, 0, 0, nullptr);
+            if (mapping != nullptr)
+            {
+                view = MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0);
+                // The view keeps the mapping alive after its handle is closed.
+                CloseHandle(mapping);
+            }
+        }
+        CloseHandle(file);
+        if (view == nullptr)
+        {
+            return nullptr;
+        }
+        size = size_t(fileSize.QuadPart);
+        return std::shared_ptr<const void>(view, [](const void *data) { UnmapViewOfFile(data); });
+#else
+        int fd = open(path.c_str(), O_RDONLY);
+        if (fd == -1)
+        {
+            return nullptr;
+        }
+        void *mapping = MAP_FAILED;
+        struct stat fileStat;
+        if (fstat(fd, &fileStat) == 0 && fileStat.st_size > 0)
+        {
+            mapping = mmap(nullptr, fileStat.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+        }
+        // The mapping stays valid after the file is closed.
+        close(fd);
+        if (mapping == MAP_FAILED)
+        {
+            return nullptr;
+        }
+        size = fileStat.st_size;
+        return std::shared_ptr<const void>(mapping, [size](const void *data) { munmap(const_cast<void *>(data), size); });
+#endif
+    }
+
+    // Reads a whole file into memory aligned to ArrayAlignment, for files that can't be mapped.
+    // Returns nullptr if the file can't be read.
+    inline std::shared_ptr<const void> readFile(const std::string &path, size_t &size)
+    {
+        size = 0;
+        std::ifstream file(path, std::ios::binary | std::ios::ate);
+        if (!file.is_open())
+        {
+            return nullptr;
+        }
+        size_t fileSize = size_t(file.tellg());
+        struct alignas(ArrayAlignment) Block
+        {
+            char bytes[ArrayAlignment];
+        };
+        auto blocks = std::make_shared<std::vector<Block>>((fileSize + ArrayAlignment - 1) / ArrayAlignment);
+        file.seekg(0);
+        if (!file.read(reinterpret_cast<char *>(blocks->data()), fileSize))
+        {
+            return nullptr;
+        }
+        size = fileSize;
+        return std::shared_ptr<const void>(blocks, blocks->data());
+    }
+
+    // Reads a cache file through a read-only memory mapping, see mapFile, or reads it whole where it can't be mapped.
+    // valid is false when the file is missing, was written by another version or for another key.
+    // Arrays read as Array keep the file mapped after the reader is gone.
+    class Reader
+    {
+    public:
+        Reader(const std::string &path, uint64_t key)
+        {
+            m_mapping = mapFile(path, m_size);
+            if (!m_mapping)
+            {
+                m_mapping = readFile(path, m_size);
+            }
+            m_data = static_cast<const char *>(m_mapping.get());
+
+            Header header;
+            m_valid = readValue(header) && header.magic == Magic && header.version == Version && header.key == key;
+        }
+
+        Reader(const Reader &) = delete;
+        Reader &operator=(const Reader &) = delete;
+
+        bool valid() const { return m_valid; }
+
+        // Reads an array in place, without copying it. Returns false if the file is too short.
+        template <typename T>
+        bool read(Array<T> &values)
+        {
+            static_assert(std::is_trivially_copyable<T>::value, "only trivially copyable types can be cached");
+            uint64_t count;
+            if (!readValue(count) || alignArray(m_position) > m_size)
+            {
+                return false;
+            }
+            m_position = alignArray(m_position);
+            if (count > (m_size - m_position) / sizeof(T))
+            {
+                return false;
+            }
+            values = Array<T>(m_mapping, reinterpret_cast<const T *>(m_data + m_position), count);
+            m_position += count * sizeof(T);
+            return true;
+        }
+
+        // Copies an array out of the file, for arrays that are changed after loading.
+        template <typename T>
+        bool read(std::vector<T> &values)
+        {
+            Array<T> mapped;
+            if (!read(mapped))
+            {
+                return false;
+            }
+            values.assign(mapped.begin(), mapped.end());
+            return true;
+        }
+
+        template <typename T>
+        bool readValue(T &value)
+        {
+            static_assert(std::is_trivially_copyable<T>::value, "only trivially copyable types can be cached");
+            if (m_data == nullptr || m_size - m_position < sizeof(T))
+            {
+                return false;
+            }
+            std::memcpy(&value, m_data + m_position, sizeof(T));
+            m_position += sizeof(T);
+            return true;
+        }
+
+    private:
+        std::shared_ptr<const void> m_mapping;
+        const char *m_data = nullptr;
+        size_t m_size = 0;
+        size_t m_position = 0;
+        bool m_valid = false;
+    };
+}
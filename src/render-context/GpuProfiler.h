@@ -0,0 +1,274 @@
+#pragma once
+
+#include "../utils/vulkan.h"
+#include "../app-context/VulkanApplicationContext.h"
+#include <string>
+#include <vector>
+#include <deque>
+#include <fstream>
+#include <ostream>
+#include <iostream>
+#include <algorithm>
+#include <stdexcept>
+
+namespace mcvkp
+{
+    /*
+     * Measures the GPU time of named regions of command buffers with timestamp queries.
+     * Every frame, i.e. every command buffer recorded once and submitted again and again, has a query pool of its own.
+     * Results of a frame are read by collect once its previous submission is known to be done, so reading never waits for the GPU.
+     * Keeps the durations of the last historySize frames per scope for rolling min/avg/max and a Chrome trace.
+     * On queues without timestamp support the profiler turns itself off and records nothing.
+     */
+    class GpuProfiler
+    {
+    public:
+        struct Stats
+        {
+            double minMs = 0.0;
+            double avgMs = 0.0;
+            double maxMs = 0.0;
+        };
+
+        GpuProfiler(uint32_t numFrames, uint32_t maxScopes = 16, size_t historySize = 128)
+            : m_maxScopes(maxScopes), m_historySize(historySize), m_queryPools(numFrames), m_frameScopes(numFrames)
+        {
+            VkPhysicalDevice physicalDevice = VulkanGlobal::context.getPhysicalDevice();
+            VkPhysicalDeviceProperties properties;
+            vkGetPhysicalDeviceProperties(physicalDevice, &properties);
+            m_timestampPeriod = properties.limits.timestampPeriod;
+
+            uint32_t queueFamilyIndex = VulkanGlobal::context.getVkbDevice().get_queue_index(vkb::QueueType::graphics).value();
+            uint32_t queueFamilyCount = 0;
+            vkGetPhysicalDeviceQueueFamilyProperties(physicalDevice, &queueFamilyCount, nullptr);
+            std::vector<VkQueueFamilyProperties> queueFamilies(queueFamilyCount);
+            vkGetPhysicalDeviceQueueFamilyProperties(physicalDevice, &queueFamilyCount, queueFamilies.data());
+            uint32_t validBits = queueFamilies[queueFamilyIndex].timestampValidBits;
+            if (validBits == 0)
+            {
+                std::cout << "GpuProfiler: the graphics queue doesn't support timestamps, GPU times are not measured\n";
+                return;
+            }
+            m_enabled = true;
+            m_timestampMask = validBits == 64 ? ~0ull : (1ull << validBits) - 1;
+
+            VkQueryPoolCreateInfo queryPoolInfo{};
+            queryPoolInfo.sType = VK_STRUCTURE_TYPE_QUERY_POOL_CREATE_INFO;
+            queryPoolInfo.queryType = VK_QUERY_TYPE_TIMESTAMP;
+            queryPoolInfo.queryCount = 2 * maxScopes;
+            for (auto &queryPool : m_queryPools)
+            {
+                if (vkCreateQueryPool(VulkanGlobal::context.getDevice(), &queryPoolInfo, nullptr, &queryPool) != VK_SUCCESS)
+                {
+                    throw std::runtime_error("failed to create query pool!");
+                }
+            }
+        }
+
+        ~GpuProfiler()
+        {
+            for (auto &queryPool : m_queryPools)
+            {
+                if (queryPool != VK_NULL_HANDLE)
+                {
+                    vkDestroyQueryPool(VulkanGlobal::context.getDevice(), queryPool, nullptr);
+                }
+            }
+        }
+
+        GpuProfiler(const GpuProfiler &) = delete;
+        GpuProfiler &operator=(const GpuProfiler &) = delete;
+
+        // False if the queue has no timestamps, then all recording and collecting does nothing.
+        bool enabled() const { return m_enabled; }
+
+        // Starts recording the scopes of a frame, has to be the first command of its command buffer.
+        void beginFrame(VkCommandBuffer commandBuffer, uint32_t frame)
+        {
+            if (!m_enabled)
+            {
+                return;
+            }
+            m_frameScopes[frame].clear();
+            vkCmdResetQueryPool(commandBuffer, m_queryPools[frame], 0, 2 * m_maxScopes);
+        }
+
+        // Scopes can be nested, every beginScope needs an endScope in the same command buffer.
+        void beginScope(VkCommandBuffer commandBuffer, uint32_t frame, const std::string &name)
+        {
+            if (!m_enabled)
+            {
+                return;
+            }
+            auto &frameScopes = m_frameScopes[frame];
+            if (frameScopes.size() == m_maxScopes)
+            {
+                throw std::runtime_error("too many profiler scopes in a frame!");
+            }
+            frameScopes.push_back({scopeIndex(name), false});
+            vkCmdWriteTimestamp(commandBuffer, VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT, m_queryPools[frame], 2 * (frameScopes.size() - 1));
+        }
+
+        void endScope(VkCommandBuffer commandBuffer, uint32_t frame)
+        {
+            if (!m_enabled)
+            {
+                return;
+            }
+            auto &frameScopes = m_frameScopes[frame];
+            auto open = std::find_if(frameScopes.rbegin(), frameScopes.rend(), [](const RecordedScope &scope) { return !scope.closed; });
+            if (open == frameScopes.rend())
+            {
+                throw std::runtime_error("profiler scope ended without being started!");
+            }
+            open->closed = true;
+            uint32_t scope = frameScopes.rend() - open - 1;
+            vkCmdWriteTimestamp(commandBuffer, VK_PIPELINE_STAGE_BOTTOM_OF_PIPE_BIT, m_queryPools[frame], 2 * scope + 1);
+        }
+
+        // Reads the timestamps of the last submission of frame. Must only be called once that submission is done,
+        // e.g. after waiting for its fence.
+        void collect(uint32_t frame)
+        {
+            auto &frameScopes = m_frameScopes[frame];
+            if (frameScopes.empty())
+            {
+                return;
+            }
+            std::vector<uint64_t> timestamps(2 * frameScopes.size());
+            VkResult result = vkGetQueryPoolResults(VulkanGlobal::context.getDevice(), m_queryPools[frame], 0, timestamps.size(),
+                                                    timestamps.size() * sizeof(uint64_t), timestamps.data(), sizeof(uint64_t),
+                                                    VK_QUERY_RESULT_64_BIT);
+            if (result != VK_SUCCESS)
+            {
+                return;
+            }
+
+            if (m_firstTimestamp == 0)
+            {
+                m_firstTimestamp = timestamps[0];
+            }
+            for (size_t i = 0; i < frameScopes.size(); i++)
+            {
+                Scope &scope = m_scopes[frameScopes[i].scopeIndex];
+                double durationMs = toMs((timestamps[2 * i + 1] - timestamps[2 * i]) & m_timestampMask);
+                double startMs = toMs((timestamps[2 * i] - m_firstTimestamp) & m_timestampMask);
+                scope.durationsMs.push_back(durationMs);
+                scope.startsMs.push_back(startMs);
+                if (scope.durationsMs.size() > m_historySize)
+                {
+                    scope.durationsMs.pop_front();
+                    scope.startsMs.pop_front();
+                }
+            }
+        }
+
+        // Names of the scopes in the order they were first recorded.
+        std::vector<std::string> getScopeNames() const
+        {
+            std::vector<std::string> names;
+            for (auto &scope : m_scopes)
+            {
+                names.push_back(scope.name);
+            }
+            return names;
+        }
+
+        // Rolling statistics of the last historySize collected durations of a scope, zero if there are none.
+        Stats getStats(const std::string &name) const
+        {
+            Stats stats;
+            for (auto &scope : m_scopes)
+            {
+                if (scope.name != name || scope.durationsMs.empty())
+                {
+                    continue;
+                }
+                stats.minMs = *std::min_element(scope.durationsMs.begin(), scope.durationsMs.end());
+                stats.maxMs = *std::max_element(scope.durationsMs.begin(), scope.durationsMs.end());
+                for (double duration : scope.durationsMs)
+                {
+                    stats.avgMs += duration;
+                }
+                stats.avgMs /= scope.durationsMs.size();
+            }
+            return stats;
+        }
+
+        void print(std::ostream &out) const
+        {
+            for (auto &scope : m_scopes)
+            {
+                Stats stats = getStats(scope.name);
+                out << "GPU " << scope.name << ": avg " << stats.avgMs << " ms, min " << stats.minMs << " ms, max " << stats.maxMs << " ms\n";
+            }
+        }
+
+        // Writes the collected scopes as complete events of the Chrome trace event format, for chrome://tracing or Perfetto.
+        // Returns false if the file could not be written.
+        bool writeChromeTrace(const std::string &path) const
+        {
+            std::ofstream file(path);
+            file << "{\"traceEvents\": [";
+            bool first = true;
+            for (auto &scope : m_scopes)
+            {
+                for (size_t i = 0; i < scope.durationsMs.size(); i++)
+                {
+                    // Times are in microseconds.
+                    file << (first ? "\n" : ",\n") << "  {\"name\": \"" << scope.name << "\", \"cat\": \"gpu\", \"ph\": \"X\", \"pid\": 0, \"tid\": 0, \"ts\": "
+                         << scope.startsMs[i] * 1000.0 << ", \"dur\": " << scope.durationsMs[i] * 1000.0 << "}";
+                    first = false;
+                }
+            }
+            file << "\n], \"displayTimeUnit\": \"ms\"}\n";
+            file.close();
+            return bool(file);
+        }
+
+    private:
+        struct Scope
+        {
+            std::string name;
+            std::deque<double> durationsMs;
+            // Start of every duration, relative to the first collected timestamp.
+            std::deque<double> startsMs;
+        };
+
+        // Scope recorded into a frame, its timestamps are the queries 2 * i and 2 * i + 1 for the i-th recorded scope.
+        struct RecordedScope
+        {
+            size_t scopeIndex;
+            bool closed;
+        };
+
+        size_t scopeIndex(const std::string &name)
+        {
+            for (size_t i = 0; i < m_scopes.size(); i++)
+            {
+                if (m_scopes[i].name == name)
+                {
+                    return i;
+                }
+            }
+            m_scopes.push_back({name});
+            return m_scopes.size() - 1;
+        }
+
+        double toMs(uint64_t ticks) const
+        {
+            // timestampPeriod is in nanoseconds per tick.
+            return ticks * double(m_timestampPeriod) * 1e-6;
+        }
+
+        uint32_t m_maxScopes;
+        size_t m_historySize;
+        float m_timestampPeriod;
+        uint64_t m_timestampMask;
+        uint64_t m_firstTimestamp = 0;
+        bool m_enabled = false;
+        std::vector<VkQueryPool> m_queryPools;
+        std::vector<std::vector<RecordedScope>> m_frameScopes;
+        std::vector<Scope> m_scopes;
+    };
+}
@@ -8,7 +8,7 @@ namespace mcvkp
 {
     ComputeMaterial::ComputeMaterial(const std::string &computeShaderPath) : m_computeShaderPath(computeShaderPath)
     {
-        m_descriptorSetsSize = VulkanGlobal::swapchainContext.getImages().size();
+        m_descriptorSetsSize = VulkanGlobal::swapchainContext.getImageCount();
         m_initialized = false;
     }
 
@@ -25,6 +25,16 @@ namespace mcvkp
         m_initialized = true;
     }
 
+    void ComputeMaterial::addSpecializationConstant(uint32_t constantId, uint32_t value)
+    {
+        VkSpecializationMapEntry entry{};
+        entry.constantID = constantId;
+        entry.offset = m_specializationData.size() * sizeof(uint32_t);
+        entry.size = sizeof(uint32_t);
+        m_specializationEntries.push_back(entry);
+        m_specializationData.push_back(value);
+    }
+
     void ComputeMaterial::__initComputePipeline(const std::string &computeShaderPath)
     {
         VkPipelineLayoutCreateInfo pipelineLayoutInfo{};
@@ -46,6 +56,16 @@ namespace mcvkp
         shaderStageInfo.module = shaderModule;
         shaderStageInfo.pName = "main";
 
+        VkSpecializationInfo specializationInfo{};
+        specializationInfo.mapEntryCount = m_specializationEntries.size();
+        specializationInfo.pMapEntries = m_specializationEntries.data();
+        specializationInfo.dataSize = m_specializationData.size() * sizeof(uint32_t);
+        specializationInfo.pData = m_specializationData.data();
+        if (!m_specializationEntries.empty())
+        {
+            shaderStageInfo.pSpecializationInfo = &specializationInfo;
+        }
+
         VkComputePipelineCreateInfo computePipelineCreateInfo{};
         computePipelineCreateInfo.sType = VK_STRUCTURE_TYPE_COMPUTE_PIPELINE_CREATE_INFO;
         computePipelineCreateInfo.layout = m_pipelineLayout;
@@ -62,7 +82,9 @@ namespace mcvkp
 
     void ComputeMaterial::bind(VkCommandBuffer &commandBuffer, size_t currentFrame)
     {
-        vkCmdBindDescriptorSets(commandBuffer, VK_PIPELINE_BIND_POINT_COMPUTE, m_pipelineLayout, 0, 1, &m_descriptorSets[currentFrame], 0, nullptr);
+        std::vector<uint32_t> dynamicOffsets = __dynamicOffsets(currentFrame);
+        vkCmdBindDescriptorSets(commandBuffer, VK_PIPELINE_BIND_POINT_COMPUTE, m_pipelineLayout, 0, 1, &m_descriptorSets[currentFrame],
+                                static_cast<uint32_t>(dynamicOffsets.size()), dynamicOffsets.data());
 
         vkCmdBindPipeline(commandBuffer, VK_PIPELINE_BIND_POINT_COMPUTE, m_pipeline);
     }
@@ -16,6 +16,9 @@ namespace mcvkp
 
         void init();
 
+        // Sets the value of a specialization constant of the shader, has to be called before init.
+        void addSpecializationConstant(uint32_t constantId, uint32_t value);
+
         void bind(VkCommandBuffer &commandBuffer, size_t currentFrame);
 
     private:
@@ -23,5 +26,7 @@ namespace mcvkp
 
     private:
         std::string m_computeShaderPath;
+        std::vector<VkSpecializationMapEntry> m_specializationEntries;
+        std::vector<uint32_t> m_specializationData;
     };
 }
@@ -10,12 +10,12 @@ namespace mcvkp
         const std::string &vertexShaderPath,
         const std::string &fragmentShaderPath) : m_fragmentShaderPath(fragmentShaderPath), m_vertexShaderPath(vertexShaderPath), m_initialized(false)
     {
-        m_descriptorSetsSize = VulkanGlobal::swapchainContext.getImages().size();
+        m_descriptorSetsSize = VulkanGlobal::swapchainContext.getImageCount();
     }
 
     Material::Material()
     {
-        m_descriptorSetsSize = VulkanGlobal::swapchainContext.getImages().size();
+        m_descriptorSetsSize = VulkanGlobal::swapchainContext.getImageCount();
     }
 
     Material::~Material()
@@ -53,11 +53,21 @@ namespace mcvkp
         m_uniformBufferBundleDescriptors.push_back({bufferBundle, shaderStageFlags});
     }
 
+    void Material::addUniformRing(const std::shared_ptr<UniformRing> &uniformRing, VkShaderStageFlags shaderStageFlags)
+    {
+        m_uniformRingDescriptors.push_back({uniformRing, shaderStageFlags});
+    }
+
     void Material::addStorageBufferBundle(const std::shared_ptr<BufferBundle> &bufferBundle, VkShaderStageFlags shaderStageFlags)
     {
         m_storageBufferBundleDescriptors.push_back({bufferBundle, shaderStageFlags});
     }
 
+    void Material::addStorageBuffer(const std::shared_ptr<Buffer> &buffer, VkShaderStageFlags shaderStageFlags)
+    {
+        addStorageBufferBundle(std::make_shared<BufferBundle>(m_descriptorSetsSize, buffer), shaderStageFlags);
+    }
+
     void Material::addStorageImage(const std::shared_ptr<Image> &image, VkShaderStageFlags shaderStageFlags)
     {
         m_storageImageDescriptors.push_back({image, shaderStageFlags});
@@ -68,6 +78,11 @@ namespace mcvkp
         return m_uniformBufferBundleDescriptors;
     }
 
+    const std::vector<Descriptor<UniformRing> > &Material::getUniformRings() const
+    {
+        return m_uniformRingDescriptors;
+    }
+
     const std::vector<Descriptor<BufferBundle> > &Material::getStorageBufferBundles() const
     {
         return m_storageBufferBundleDescriptors;
@@ -270,11 +285,22 @@ namespace mcvkp
             bindings.push_back(uboLayoutBinding);
         }
 
+        for (size_t ring_i = 0; ring_i < m_uniformRingDescriptors.size(); ring_i++)
+        {
+            VkDescriptorSetLayoutBinding ringLayoutBinding{};
+            ringLayoutBinding.binding = m_uniformBufferBundleDescriptors.size() + ring_i;
+            ringLayoutBinding.descriptorType = VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER_DYNAMIC;
+            ringLayoutBinding.descriptorCount = 1;
+            ringLayoutBinding.stageFlags = m_uniformRingDescriptors[ring_i].shaderStageFlags;
+            ringLayoutBinding.pImmutableSamplers = nullptr;
+            bindings.push_back(ringLayoutBinding);
+        }
+
         for (size_t tex_i = 0; tex_i < m_textureDescriptors.size(); tex_i++)
         {
             VkDescriptorImageInfo imageInfo = m_textureDescriptors[tex_i].data->getDescriptorInfo();
 
-            size_t binding = m_uniformBufferBundleDescriptors.size() + tex_i;
+            size_t binding = m_uniformBufferBundleDescriptors.size() + m_uniformRingDescriptors.size() + tex_i;
             VkDescriptorSetLayoutBinding samplerLayoutBinding{};
             samplerLayoutBinding.binding = binding;
             samplerLayoutBinding.descriptorCount = 1;
@@ -288,7 +314,7 @@ namespace mcvkp
         {
             VkDescriptorImageInfo imageInfo = m_storageImageDescriptors[tex_i].data->getDescriptorInfo(VK_IMAGE_LAYOUT_GENERAL);
 
-            size_t binding = m_uniformBufferBundleDescriptors.size() + m_textureDescriptors.size() + tex_i;
+            size_t binding = m_uniformBufferBundleDescriptors.size() + m_uniformRingDescriptors.size() + m_textureDescriptors.size() + tex_i;
             VkDescriptorSetLayoutBinding samplerLayoutBinding{};
             samplerLayoutBinding.binding = binding;
             samplerLayoutBinding.descriptorCount = 1;
@@ -300,7 +326,7 @@ namespace mcvkp
 
         for (size_t buffer_i = 0; buffer_i < m_storageBufferBundleDescriptors.size(); buffer_i++)
         {
-            size_t binding = m_uniformBufferBundleDescriptors.size() + m_textureDescriptors.size() + m_storageImageDescriptors.size() + buffer_i;
+            size_t binding = m_uniformBufferBundleDescriptors.size() + m_uniformRingDescriptors.size() + m_textureDescriptors.size() + m_storageImageDescriptors.size() + buffer_i;
             VkDescriptorSetLayoutBinding storageBufferBinding{};
             storageBufferBinding.binding = binding;
             storageBufferBinding.descriptorCount = 1;
@@ -333,6 +359,14 @@ namespace mcvkp
             poolSizes.push_back(size);
         }
 
+        for (size_t ring_i = 0; ring_i < m_uniformRingDescriptors.size(); ring_i++)
+        {
+            VkDescriptorPoolSize size;
+            size.type = VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER_DYNAMIC;
+            size.descriptorCount = static_cast<uint32_t>(m_descriptorSetsSize);
+            poolSizes.push_back(size);
+        }
+
         for (size_t tex_i = 0; tex_i < m_textureDescriptors.size(); tex_i++)
         {
             VkDescriptorPoolSize size;
@@ -384,7 +418,7 @@ namespace mcvkp
             throw std::runtime_error("failed to allocate descriptor sets!");
         }
 
-        size_t numDescriptors = m_uniformBufferBundleDescriptors.size() + m_textureDescriptors.size() + m_storageImageDescriptors.size();
+        size_t numDescriptors = m_uniformBufferBundleDescriptors.size() + m_uniformRingDescriptors.size() + m_textureDescriptors.size() + m_storageImageDescriptors.size();
 
         for (size_t i = 0; i < m_descriptorSetsSize; i++)
         {
@@ -413,6 +447,26 @@ namespace mcvkp
 
                 descriptorWrites.push_back(descriptorSet);
             }
+
+            std::vector<VkDescriptorBufferInfo> ringDescInfos;
+            for (size_t ring_i = 0; ring_i < m_uniformRingDescriptors.size(); ring_i++)
+            {
+                ringDescInfos.push_back(m_uniformRingDescriptors[ring_i].data->getDescriptorInfo());
+            }
+
+            for (size_t ring_i = 0; ring_i < m_uniformRingDescriptors.size(); ring_i++)
+            {
+                VkWriteDescriptorSet descriptorSet{};
+                descriptorSet.sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
+                descriptorSet.dstSet = m_descriptorSets[i];
+                descriptorSet.dstBinding = m_uniformBufferBundleDescriptors.size() + ring_i;
+                descriptorSet.dstArrayElement = 0;
+                descriptorSet.descriptorType = VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER_DYNAMIC;
+                descriptorSet.descriptorCount = 1;
+                descriptorSet.pBufferInfo = &ringDescInfos[ring_i];
+
+                descriptorWrites.push_back(descriptorSet);
+            }
             std::vector<VkDescriptorImageInfo> imageInfos;
             for (size_t tex_i = 0; tex_i < m_textureDescriptors.size(); tex_i++)
             {
@@ -421,7 +475,7 @@ namespace mcvkp
 
             for (size_t tex_i = 0; tex_i < m_textureDescriptors.size(); tex_i++)
             {
-                size_t binding = m_uniformBufferBundleDescriptors.size() + tex_i;
+                size_t binding = m_uniformBufferBundleDescriptors.size() + m_uniformRingDescriptors.size() + tex_i;
                 VkWriteDescriptorSet descriptorSet{};
                 descriptorSet.sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
                 descriptorSet.dstSet = m_descriptorSets[i];
@@ -442,7 +496,7 @@ namespace mcvkp
 
             for (size_t tex_i = 0; tex_i < m_storageImageDescriptors.size(); tex_i++)
             {
-                size_t binding = m_uniformBufferBundleDescriptors.size() + m_textureDescriptors.size() + tex_i;
+                size_t binding = m_uniformBufferBundleDescriptors.size() + m_uniformRingDescriptors.size() + m_textureDescriptors.size() + tex_i;
                 VkWriteDescriptorSet descriptorSet{};
                 descriptorSet.sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
                 descriptorSet.dstSet = m_descriptorSets[i];
@@ -463,7 +517,7 @@ namespace mcvkp
 
             for (size_t buffer_i = 0; buffer_i < m_storageBufferBundleDescriptors.size(); buffer_i++)
             {
-                size_t binding = m_uniformBufferBundleDescriptors.size() + m_textureDescriptors.size() + m_storageImageDescriptors.size() + buffer_i;
+                size_t binding = m_uniformBufferBundleDescriptors.size() + m_uniformRingDescriptors.size() + m_textureDescriptors.size() + m_storageImageDescriptors.size() + buffer_i;
                 VkWriteDescriptorSet descriptorSet{};
                 descriptorSet.sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
                 descriptorSet.dstSet = m_descriptorSets[i];
@@ -479,9 +533,21 @@ namespace mcvkp
         }
     }
 
+    std::vector<uint32_t> Material::__dynamicOffsets(size_t currentFrame) const
+    {
+        std::vector<uint32_t> dynamicOffsets;
+        for (auto &ring : m_uniformRingDescriptors)
+        {
+            dynamicOffsets.push_back(ring.data->getDynamicOffset(currentFrame));
+        }
+        return dynamicOffsets;
+    }
+
     void Material::bind(VkCommandBuffer &commandBuffer, size_t currentFrame)
     {
-        vkCmdBindDescriptorSets(commandBuffer, VK_PIPELINE_BIND_POINT_GRAPHICS, m_pipelineLayout, 0, 1, &m_descriptorSets[currentFrame], 0, nullptr);
+        std::vector<uint32_t> dynamicOffsets = __dynamicOffsets(currentFrame);
+        vkCmdBindDescriptorSets(commandBuffer, VK_PIPELINE_BIND_POINT_GRAPHICS, m_pipelineLayout, 0, 1, &m_descriptorSets[currentFrame],
+                                static_cast<uint32_t>(dynamicOffsets.size()), dynamicOffsets.data());
 
         vkCmdBindPipeline(commandBuffer, VK_PIPELINE_BIND_POINT_GRAPHICS, m_pipeline);
     }
@@ -32,10 +32,18 @@ namespace mcvkp
 
         void addUniformBufferBundle(const std::shared_ptr<BufferBundle> &bufferBundle, VkShaderStageFlags shaderStageFlags);
 
+        // Bound after the uniform buffer bundles, with the region of the bound frame selected by a dynamic offset.
+        void addUniformRing(const std::shared_ptr<UniformRing> &uniformRing, VkShaderStageFlags shaderStageFlags);
+
         void addStorageBufferBundle(const std::shared_ptr<BufferBundle> &bufferBundle, VkShaderStageFlags shaderStageFlags);
 
+        // Binds one buffer into every descriptor set, for storage buffers that are the same for all frames.
+        void addStorageBuffer(const std::shared_ptr<Buffer> &buffer, VkShaderStageFlags shaderStageFlags);
+
         const std::vector<Descriptor<BufferBundle> > &getUniformBufferBundles() const;
 
+        const std::vector<Descriptor<UniformRing> > &getUniformRings() const;
+
         const std::vector<Descriptor<BufferBundle> > &getStorageBufferBundles() const;
 
         const std::vector<Descriptor<Texture> > &getTextures() const;
@@ -57,9 +65,11 @@ namespace mcvkp
             std::string vertexShaderPath,
             std::string fragmentShaderPath);
         VkShaderModule __createShaderModule(const std::vector<char> &code);
+        std::vector<uint32_t> __dynamicOffsets(size_t currentFrame) const;
 
     protected:
         std::vector<Descriptor<BufferBundle> > m_uniformBufferBundleDescriptors;
+        std::vector<Descriptor<UniformRing> > m_uniformRingDescriptors;
         std::vector<Descriptor<BufferBundle> > m_storageBufferBundleDescriptors;
         std::vector<Descriptor<Texture> > m_textureDescriptors;
         std::vector<Descriptor<Image> > m_storageImageDescriptors;
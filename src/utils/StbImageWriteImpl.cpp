@@ -0,0 +1,17 @@
+#define STB_IMAGE_WRITE_IMPLEMENTATION
+#include <stb_image_write.h>
+
+#include "StbImageWriteImpl.h"
+
+namespace StbImageWriteImpl
+{
+    bool writePng(const std::string &path, int width, int height, const unsigned char *pixels)
+    {
+        return stbi_write_png(path.c_str(), width, height, 4, pixels, width * 4) != 0;
+    }
+
+    bool writeHdr(const std::string &path, int width, int height, const float *pixels)
+    {
+        return stbi_write_hdr(path.c_str(), width, height, 4, pixels) != 0;
+    }
+}
@@ -0,0 +1,12 @@
+#pragma once
+
+#include <string>
+
+namespace StbImageWriteImpl
+{
+    // Writes 8 bit RGBA pixels as a PNG. Returns false if the file could not be written.
+    bool writePng(const std::string &path, int width, int height, const unsigned char *pixels);
+
+    // Writes float RGBA pixels as a Radiance HDR file, alpha is dropped. Returns false if the file could not be written.
+    bool writeHdr(const std::string &path, int width, int height, const float *pixels);
+}